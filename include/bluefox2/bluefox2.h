@@ -5,68 +5,187 @@
 #include <sensor_msgs/CameraInfo.h>
 #include "bluefox2/Bluefox2DynConfig.h"
 #include "bluefox2/bluefox2_setting.h"
+#include "bluefox2/calibration_cache.h"
+#include "bluefox2/camera_backend.h"
+#include "bluefox2/clock_sync.h"
+#include "bluefox2/frame_metadata.h"
+#include "bluefox2/latency.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 
 namespace bluefox2 {
 
-class Bluefox2 {
+/**
+ * @brief The FrameFormat struct Layout of the images the driver delivers
+ * It only changes with the settings, so it is read once per configuration
+ * instead of once per frame
+ */
+struct FrameFormat {
+  const std::string *encoding{nullptr};
+  uint32_t width{0};
+  uint32_t height{0};
+  uint32_t step{0};
+
+  bool valid() const { return encoding != nullptr; }
+  void Invalidate() { encoding = nullptr; }
+};
+
+class Bluefox2 : public CameraBackend {
  public:
   explicit Bluefox2(const std::string &serial);
   ~Bluefox2();
 
-  const std::string &serial() const { return serial_; }
+  const std::string &serial() const override { return serial_; }
   std::string product() const { return dev_->product.readS(); }
   int timeout_ms() const { return timeout_ms_; }
   void set_timeout_ms(int timeout_ms) { timeout_ms_ = timeout_ms; }
-
-  int GetExposeUs() const;
+  bool user_buffer() const { return user_buffer_; }
+  void set_user_buffer(bool user_buffer) override {
+    user_buffer_ = user_buffer;
+  }
+
+  bool streaming() const { return streaming_; }
+  bool hardware_timed() const override {
+    return config_.ctm == Bluefox2Dyn_ctm_hardware_timed;
+  }
+  bool hw_stamp() const override { return hw_stamp_; }
+  void set_hw_stamp(bool hw_stamp) override { hw_stamp_ = hw_stamp; }
+  int64_t frame_nr() const { return frame_nr_; }
+  void set_calibration_cache(const std::string &path) override;
+  int bracket_count() const override { return bracket_count_; }
+  std::vector<int> pixel_clocks() const override;
+  bool calibrating() const { return wb_pending_ || dark_current_frames_ > 0; }
+  LatencyStats &latency() const override { return latency_; }
+
+  /**
+   * @brief GetStats Read the acquisition statistics
+   * Reads a handful of driver properties
+   */
+  Bluefox2Stats GetStats() const override;
+
+  /**
+   * @brief GetExposeUs Exposure of the last grabbed frame
+   */
+  int GetExposeUs() const { return metadata_.expose_us; }
+  const FrameMetadata &metadata() const { return metadata_; }
+
+  int64_t SetExpose(int &expose_us, double &gain_db, bool set_gain,
+                    int timeout_ms) override;
 
   void OpenDevice();
-  void RequestSingle() const;
-  void Configure(Bluefox2DynConfig &config);
-  bool GrabImage(sensor_msgs::Image &image_msg);
+  void RequestSingle() const override;
+  void Configure(Bluefox2DynConfig &config) override;
+  bool GrabImage(sensor_msgs::Image &image_msg,
+                 FrameMetadata *metadata = nullptr) override;
 
-  void SetMM(int mm) const;
-  void SetMaster() const;
-  void SetSlave() const;
+  void StartStreaming() override;
+  void StopStreaming() override { streaming_ = false; }
+  void CancelRequests() override { fi_->imageRequestReset(0, 0); }
+  void SetRequestCount(int &request_count) const override;
 
- private:
-  std::string AvailableDevice() const;
+  void SetMM(int mm) const override;
+  void SetMaster() const override;
+  void SetSlave() const override;
 
+ private:
   bool IsCtmOnDemandSupported() const;
 
   // Settings
-  void SetAoi(int &width, int &height) const;
+  void SetAoi(int &x, int &y, int &width, int &height) const;
   void SetIdpf(int &idpf) const;
   void SetCbm(int &cbm) const;
 
   void SetAgc(bool &auto_gain, double &gain_db) const;
   void SetAec(bool &auto_expose, int &expose_us) const;
   void SetAcs(int &acs, int &des_gray_val) const;
+  void SetAcAoi(int &mode, int &x, int &y, int &width, int &height) const;
+  void SetAcLimits(int &expose_min_us, int &expose_max_us, double &gain_min_db,
+                   double &gain_max_db, int fps_expose_max_us) const;
 
-  void SetWbp(int &wbp, double &r_gain, double &g_gain, double &b_gain) const;
+  void SetWbp(int &wbp, double &r_gain, double &g_gain, double &b_gain);
   void SetHdr(bool &hdr) const;
-  void SetDcfm(int &dcfm) const;
+  void SetBracket(int &count, double ev, bool auto_expose, int expose_us);
+  void SetDcfm(int &dcfm);
   void SetCpc(int &cpc) const;
+  void PlanFrameRate(Bluefox2DynConfig &config) const;
   void SetCtm(int &ctm) const;
+  void SetRtc(double fps, int digout) const;
   void SetCts(int &cts) const;
 
   // Request
+  int QueueRequest() const;
   void FillCaptureQueue(int &n) const;
-  void RequestImages(int n) const;
+
+  // Calibration
+  void StepCalibration();
+
+  // Expose
+  void CheckExpose();
+
+  // Image format
+  void ReadFrameFormat();
+
+  // Metadata and time stamp
+  void ReadFrameMetadata();
+  void StampImage(sensor_msgs::Image &image_msg, const ros::Time &arrival);
+
+  // User buffer
+  void AttachUserBuffers();
+  void DetachUserBuffers();
+  bool AttachUserBuffer(int request_nr);
 
   int timeout_ms_{200};
+  bool user_buffer_{false};
+  bool streaming_{false};
+  bool hw_stamp_{false};
+  int64_t frame_nr_{-1};
+  FrameMetadata metadata_;
+  std::atomic<int64_t> wait_timeouts_{0};
+  std::atomic<int64_t> failed_requests_{0};
+  std::atomic<int64_t> frame_nr_gaps_{0};
+  std::atomic<int64_t> user_buffer_fallbacks_{0};
+  ClockSync clock_sync_;
+  // Written by const request functions as well
+  mutable LatencyStats latency_;
+  int buffer_size_{0};
+  int buffer_alignment_{1};
+  std::vector<std::vector<uint8_t>> buffers_;
+  FrameFormat format_;
+  // Calibrations run on the frames of the stream instead of blocking
+  std::unique_ptr<CalibrationCache> calib_cache_;
+  CalibrationKey calib_key_;
+  bool wb_pending_{false};
+  int dark_current_frames_{0};
+  // Exposure written by SetExpose that no frame has shown yet
+  std::atomic<bool> expose_pending_{false};
+  int expose_target_us_{0};
+  double gain_target_db_{0};
+  bool gain_target_set_{false};
+  int64_t expose_frame_nr_{-1};
+  std::mutex expose_mutex_;
+  std::condition_variable expose_cond_;
+  // Exposure bracketing, each request uses the next setting of the bracket
+  int bracket_count_{1};
+  mutable int bracket_next_{0};
+  int base_setting_{0};
+  std::vector<int> bracket_settings_;
   std::string serial_;
   Bluefox2DynConfig config_;
+  bool configured_{false};
   mvIMPACT::acquire::Request *request_{nullptr};
-  mvIMPACT::acquire::DeviceManager dev_mgr_;
   mvIMPACT::acquire::Device *dev_{nullptr};
   mvIMPACT::acquire::FunctionInterface *fi_{nullptr};
-  //  mvIMPACT::acquire::Statistics *stats_{nullptr};
+  mvIMPACT::acquire::Statistics *stats_{nullptr};
   mvIMPACT::acquire::SettingsBlueFOX *bf_set_{nullptr};
   mvIMPACT::acquire::ImageProcessing *img_proc_{nullptr};
   mvIMPACT::acquire::CameraSettingsBlueFOX *cam_set_{nullptr};
   mvIMPACT::acquire::SystemSettings *sys_set_{nullptr};
   mvIMPACT::acquire::InfoBlueDevice *bf_info_{nullptr};
+  mvIMPACT::acquire::ImageRequestControl *irc_{nullptr};
+  mvIMPACT::acquire::IOSubSystemBlueFOX *io_{nullptr};
 };
 
 }  // namespace bluefox2
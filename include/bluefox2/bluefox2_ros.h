@@ -2,8 +2,17 @@
 #define BLUEFOX2_ROS_H_
 
 #include "bluefox2/bluefox2.h"
+#include "bluefox2/exposure_fusion.h"
+#include "bluefox2/frame_scheduler.h"
+#include "bluefox2/rig_exposure.h"
+#include "bluefox2/usb_bandwidth.h"
+#include "bluefox2/Metadata.h"
+#include "bluefox2/SetExposeSrv.h"
 #include "camera_base/camera_ros_base.h"
 
+#include <diagnostic_updater/diagnostic_updater.h>
+#include <ros/callback_queue.h>
+
 namespace bluefox2 {
 
 class Bluefox2Ros : public camera_base::CameraRosBase {
@@ -11,16 +20,134 @@ class Bluefox2Ros : public camera_base::CameraRosBase {
   explicit Bluefox2Ros(const ros::NodeHandle& nh,
                        const std::string& prefix = std::string());
 
-  void RequestSingle() const { bluefox2_.RequestSingle(); }
-  Bluefox2& camera() { return bluefox2_; }
+  void RequestSingle() const { camera_->RequestSingle(); }
+  CameraBackend& camera() { return *camera_; }
+
+  /**
+   * @brief HasSubscribers Whether anybody listens to the images or metadata
+   * of this camera, always true unless the lazy param is set
+   */
+  bool HasSubscribers() const;
+  /**
+   * @brief SetStreaming Start or stop streaming the camera
+   * Stopping drops the queued requests, so nothing more is transferred, while
+   * the camera keeps its settings and requests for a quick restart
+   */
+  void SetStreaming(bool streaming);
+
+  /**
+   * @brief AllocateImage Get an image message for grabbing into
+   * With a pool, messages that every subscriber has released are reused
+   * together with their image storage, otherwise a new message is allocated
+   */
+  sensor_msgs::ImagePtr AllocateImage();
+
+  /**
+   * @brief GrabAndPublish Grab an image and publish it with its metadata
+   * @param time Time the image was requested, the image is stamped with the
+   * middle of its exposure after it, or from the camera clock when hardware
+   * stamping is enabled
+   */
+  void GrabAndPublish(const ros::Time& time);
+  /**
+   * @brief PublishImage Publish an image that has already been grabbed
+   * @param image_msg Image message with time stamp
+   */
+  void PublishImage(const sensor_msgs::ImagePtr& image_msg);
+  /**
+   * @brief PublishMetadata Publish the metadata of an image
+   * @param metadata Metadata returned by GrabImage
+   * @param stamp Time stamp of the image it belongs to
+   */
+  void PublishMetadata(const FrameMetadata& metadata, const ros::Time& stamp);
+  /**
+   * @brief ProcessGrabbed Work that follows every grab, whichever way the node
+   * acquires: records the transfer delay, feeds the rig exposure and fuses
+   * exposure brackets
+   * @param image_msg Image message with its final time stamp
+   * @param metadata Metadata returned by GrabImage
+   */
+  void ProcessGrabbed(const sensor_msgs::Image& image_msg,
+                      const FrameMetadata& metadata);
+  /**
+   * @brief FuseBracket Add an image to the bracket being fused
+   * Publishes the fused image once the last frame of the bracket is added
+   * @param image_msg Image message with time stamp
+   * @param bracket Index of the image in the bracket
+   */
+  void FuseBracket(const sensor_msgs::Image& image_msg, int bracket);
+
+  /**
+   * @brief set_scheduler Report the jitter and overruns of a scheduler
+   * @param scheduler Scheduler that triggers this camera, nullptr when the
+   * camera is no longer triggered by it
+   */
+  void set_scheduler(FrameScheduler* scheduler) { scheduler_ = scheduler; }
+  /**
+   * @brief set_rig_exposure Feed grabbed images to a rig auto exposure
+   * @param rig_exposure Controller of the rig, nullptr to stop feeding it
+   * @param index Index of this camera in the rig
+   */
+  void set_rig_exposure(RigExposure* rig_exposure, size_t index) {
+    rig_exposure_ = rig_exposure;
+    rig_index_ = index;
+  }
+
+  /**
+   * @brief set_usb_slot Report the planned share of the usb bus next to the
+   * measured transfer delays
+   */
+  void set_usb_slot(const UsbSlot& usb_slot) {
+    usb_slot_ = usb_slot;
+    usb_planned_ = true;
+  }
 
   bool Grab(const sensor_msgs::ImagePtr& image_msg,
             const sensor_msgs::CameraInfoPtr& cinfo_msg = nullptr) override;
 
  private:
-  Bluefox2 bluefox2_;
+  bool SetExposeCb(SetExposeSrv::Request& req, SetExposeSrv::Response& res);
+  void LatencyDiagnostic(diagnostic_updater::DiagnosticStatusWrapper& stat);
+  void StatsDiagnostic(diagnostic_updater::DiagnosticStatusWrapper& stat);
+  void TriggerDiagnostic(diagnostic_updater::DiagnosticStatusWrapper& stat);
+  void UsbDiagnostic(diagnostic_updater::DiagnosticStatusWrapper& stat);
+
+  std::unique_ptr<CameraBackend> camera_;
+  diagnostic_updater::Updater updater_;
+  ros::CallbackQueue expose_queue_;
+  ros::ServiceServer expose_srv_;
+  std::unique_ptr<ros::AsyncSpinner> expose_spinner_;
+  ros::Publisher metadata_pub_;
+  bool lazy_{false};
+  bool streaming_{false};
+  image_transport::CameraPublisher image_pub_;
+  bool fuse_brackets_{false};
+  ExposureFusion fusion_;
+  sensor_msgs::ImagePtr fused_msg_;
+  image_transport::Publisher fused_pub_;
+  bool grabbed_{false};
+  LatencyClock::time_point grab_end_;
+  Bluefox2Stats last_stats_;
+  std::atomic<FrameScheduler*> scheduler_{nullptr};
+  int64_t last_overruns_{0};
+  RigExposure* rig_exposure_{nullptr};
+  size_t rig_index_{0};
+  Histogram transfer_delay_;
+  bool usb_planned_{false};
+  UsbSlot usb_slot_;
+  size_t pool_size_{0};
+  std::vector<sensor_msgs::ImagePtr> pool_;
 };
 
+/**
+ * @brief OpenDevices Open the cameras of a rig concurrently and report how
+ * long each one took, so that the rig is up in the time of the slowest camera
+ * @param pnh Private node handle
+ * @param prefixes Namespaces of the cameras, each with an identifier param
+ */
+void OpenDevices(const ros::NodeHandle& pnh,
+                 const std::vector<std::string>& prefixes);
+
 }  // namespace bluefox2
 
 #endif  // BLUEFOX2_ROS_H_
@@ -27,6 +27,21 @@ ValueType ClampProperty(const PropertyType& prop, const ValueType& value) {
   return Clamp(value, prop.getMinValue(), prop.getMaxValue());
 }
 
+/**
+ * @brief RoundToStepWidth Round value down to a valid step of the property
+ * @param prop Property
+ * @param value Value to round
+ * @return Rounded value
+ */
+template <typename PropertyType, typename ValueType>
+ValueType RoundToStepWidth(const PropertyType& prop, const ValueType& value) {
+  if (!prop.hasStepWidth()) return value;
+  const ValueType step = prop.getStepWidth();
+  if (step <= 1) return value;
+  const ValueType min = prop.hasMinValue() ? prop.getMinValue() : 0;
+  return min + (value - min) / step * step;
+}
+
 /**
  * @brief GetTranslationDict Convenience function to get translation dict
  * @param prop Property
@@ -55,9 +70,9 @@ void PrintTranslationDict(const TranslationDict<ValueType>& dict) {
 /**
  * @brief PixelFormatToEncoding Convert pixel format to image encoding
  * @param pixel_format mvIMPACT ImageBufferPixelFormat
- * @return Image encoding
+ * @return Image encoding, one of the constants in image_encodings
  */
-std::string PixelFormatToEncoding(const TImageBufferPixelFormat& pixel_format);
+const std::string& PixelFormatToEncoding(const TImageBufferPixelFormat& pixel_format);
 
 /**
  * @brief BayerPatternToEncoding Convert bayer pattern to image encoding
@@ -65,12 +80,20 @@ std::string PixelFormatToEncoding(const TImageBufferPixelFormat& pixel_format);
  * @param bytes_per_pixel Number of bytes per pixel
  * @return Image encoding
  */
-std::string BayerPatternToEncoding(const TBayerMosaicParity& bayer_pattern,
-                                   int bytes_per_pixel);
+const std::string& BayerPatternToEncoding(
+    const TBayerMosaicParity& bayer_pattern, int bytes_per_pixel);
 
 double PixelClockToFrameRate(int pclk_khz, double width, double height,
                              double expose_us);
 
+/**
+ * @brief PlanPixelClock Lowest pixel clock at which the sensor reaches fps
+ * @param pclks_khz Pixel clocks supported by the camera, must not be empty
+ * @return Lowest pixel clock that reaches fps, the highest one if none does
+ */
+int PlanPixelClock(std::vector<int> pclks_khz, double fps, double width,
+                   double height, double expose_us);
+
 template <typename Prop>
 void PrintProperty(const Prop& prop) {
   std::cout << "Property name: " << prop.displayName() << "\n";
@@ -0,0 +1,62 @@
+#ifndef BLUEFOX2_CALIBRATION_CACHE_H_
+#define BLUEFOX2_CALIBRATION_CACHE_H_
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <tuple>
+
+namespace bluefox2 {
+
+/**
+ * @brief The CalibrationKey struct Settings a calibration result depends on
+ */
+struct CalibrationKey {
+  int expose_us{0};
+  double gain_db{0};
+  int pixel_clock_khz{0};
+};
+
+struct WhiteBalanceGains {
+  double r_gain{1};
+  double g_gain{1};
+  double b_gain{1};
+};
+
+/**
+ * @brief The CalibrationCache class
+ * Calibration results of one camera kept in a text file, so that they are
+ * reloaded instead of calibrated again every time the node starts
+ */
+class CalibrationCache {
+ public:
+  /**
+   * @brief CalibrationCache Load the cache file if it exists
+   * @param path Path of the cache file, created on the first Store
+   */
+  explicit CalibrationCache(const std::string &path);
+
+  const std::string &path() const { return path_; }
+
+  bool Find(const CalibrationKey &key, WhiteBalanceGains &gains) const;
+  /**
+   * @brief Store Add a white balance result and write the file
+   * @return False if the file could not be written
+   */
+  bool Store(const CalibrationKey &key, const WhiteBalanceGains &gains);
+
+ private:
+  // Gain is kept in steps of 0.01 dB, so that keys compare exactly
+  using Key = std::tuple<int, int64_t, int>;
+  static Key MakeKey(const CalibrationKey &key);
+
+  void Load();
+  bool Save() const;
+
+  std::string path_;
+  std::map<Key, WhiteBalanceGains> white_balance_;
+};
+
+}  // namespace bluefox2
+
+#endif  // BLUEFOX2_CALIBRATION_CACHE_H_
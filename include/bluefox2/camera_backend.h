@@ -0,0 +1,141 @@
+#ifndef BLUEFOX2_CAMERA_BACKEND_H_
+#define BLUEFOX2_CAMERA_BACKEND_H_
+
+#include <sensor_msgs/Image.h>
+#include "bluefox2/Bluefox2DynConfig.h"
+#include "bluefox2/frame_metadata.h"
+#include "bluefox2/latency.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace bluefox2 {
+
+/**
+ * @brief The Bluefox2Stats struct Acquisition statistics of a camera
+ * Counters are totals since the device was opened
+ */
+struct Bluefox2Stats {
+  // From the driver's Statistics
+  double frames_per_second{0};
+  double capture_time_s{0};
+  double bandwidth_kbps{0};
+  int64_t frame_count{0};
+  int64_t error_count{0};
+  int64_t timed_out_count{0};
+  int64_t aborted_count{0};
+  int64_t lost_images_count{0};
+  int64_t incomplete_count{0};
+  // From GrabImage
+  int64_t wait_timeouts{0};   // no request returned within timeout_ms
+  int64_t failed_requests{0};  // request returned but not ok
+  int64_t frame_nr_gaps{0};   // frame numbers skipped between two requests
+  // From AttachUserBuffers
+  int64_t user_buffer_fallbacks{0};  // buffers too misaligned to capture into
+};
+
+/**
+ * @brief The CameraBackend class
+ * Everything the nodes need from a camera. Bluefox2 drives a real camera
+ * through mvIMPACT, SimulatedCamera makes frames up or replays recorded ones,
+ * so the acquisition and publishing pipeline also runs without hardware.
+ */
+class CameraBackend {
+ public:
+  virtual ~CameraBackend() = default;
+
+  virtual const std::string &serial() const = 0;
+
+  /**
+   * @brief hardware_timed Whether the camera triggers itself at fps
+   * Frames then only arrive for requests that are already queued, so the
+   * camera should be streamed
+   */
+  virtual bool hardware_timed() const = 0;
+  virtual bool hw_stamp() const = 0;
+  /**
+   * @brief set_hw_stamp Stamp images in GrabImage from the camera clock
+   * The stamp is the middle of the exposure mapped to ros time
+   */
+  virtual void set_hw_stamp(bool hw_stamp) = 0;
+  /**
+   * @brief set_user_buffer Capture directly into image message storage
+   * Takes effect on the next call to Configure
+   */
+  virtual void set_user_buffer(bool user_buffer) = 0;
+  /**
+   * @brief set_calibration_cache Keep white balance calibrations in a file
+   * @param path Path of the cache file, empty to disable the cache
+   */
+  virtual void set_calibration_cache(const std::string &path) = 0;
+  /**
+   * @brief bracket_count Number of exposures requests cycle through
+   */
+  virtual int bracket_count() const = 0;
+  /**
+   * @brief pixel_clocks Pixel clocks in KHz the sensor supports
+   */
+  virtual std::vector<int> pixel_clocks() const = 0;
+  virtual LatencyStats &latency() const = 0;
+
+  /**
+   * @brief GetStats Read the acquisition statistics
+   * Meant to be sampled periodically and safe to call while another thread
+   * grabs images
+   */
+  virtual Bluefox2Stats GetStats() const = 0;
+
+  /**
+   * @brief SetExpose Change exposure and gain between two frames
+   * Unlike Configure this leaves the capture queue alone, so the stream keeps
+   * running and only frames that were already exposing keep the old values
+   * @param expose_us Exposure in us, set to the value that was written
+   * @param gain_db Gain in dB, set to the value that is in use
+   * @param set_gain Whether to write the gain as well
+   * @param timeout_ms Time to wait for a frame taken with the new values
+   * @return Number of the first frame taken with the new values, -1 if auto
+   * exposure or bracketing is on or no such frame arrived within timeout_ms
+   */
+  virtual int64_t SetExpose(int &expose_us, double &gain_db, bool set_gain,
+                            int timeout_ms) = 0;
+
+  virtual void RequestSingle() const = 0;
+  virtual void Configure(Bluefox2DynConfig &config) = 0;
+  /**
+   * @brief GrabImage Wait for the next frame and copy it into image_msg
+   * @param image_msg Image, stamped only if hardware stamping is enabled
+   * @param metadata Metadata of the frame, may be nullptr
+   * @return True if a frame was grabbed
+   */
+  virtual bool GrabImage(sensor_msgs::Image &image_msg,
+                         FrameMetadata *metadata = nullptr) = 0;
+
+  /**
+   * @brief StartStreaming Queue every request and keep them in flight
+   * While streaming, GrabImage puts each request back into the capture queue
+   * as soon as it is done with it, so the sensor never waits for the caller
+   */
+  virtual void StartStreaming() = 0;
+  /**
+   * @brief StopStreaming Stop re-queueing requests
+   * Requests still in the capture queue are kept and picked up by the next
+   * call to GrabImage
+   */
+  virtual void StopStreaming() = 0;
+  /**
+   * @brief CancelRequests Drop every request in the capture queue
+   * The sensor stops capturing until requests are queued again, while the
+   * requests and the configuration stay ready for a quick restart
+   */
+  virtual void CancelRequests() = 0;
+  virtual void SetRequestCount(int &request_count) const = 0;
+
+  virtual void SetMM(int mm) const = 0;
+  virtual void SetMaster() const = 0;
+  virtual void SetSlave() const = 0;
+};
+
+}  // namespace bluefox2
+
+#endif  // BLUEFOX2_CAMERA_BACKEND_H_
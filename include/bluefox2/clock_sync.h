@@ -0,0 +1,57 @@
+#ifndef BLUEFOX2_CLOCK_SYNC_H_
+#define BLUEFOX2_CLOCK_SYNC_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+
+namespace bluefox2 {
+
+/**
+ * @brief The ClockSync class
+ * Online estimate of the mapping from the camera clock to the host clock.
+ * Every frame gives a pair of device time and host arrival time, where the
+ * arrival is always later by some positive latency. The mapping is the edge
+ * of the lower convex hull of a window of pairs, which removes the latency
+ * jitter and keeps only its constant part.
+ */
+class ClockSync {
+ public:
+  explicit ClockSync(size_t window = 500) : window_(window) {}
+
+  /**
+   * @brief Update Add a pair of device time and host arrival time
+   * @param device_us Device time stamp in us
+   * @param host_s Host time in s at which the frame has arrived
+   */
+  void Update(int64_t device_us, double host_s);
+
+  /**
+   * @brief ToHost Map a device time stamp to host time
+   * @param device_us Device time stamp in us
+   * @return Host time in s, 0 if there is no estimate yet
+   */
+  double ToHost(int64_t device_us) const;
+
+  bool ready() const { return !samples_.empty(); }
+  void Reset() { samples_.clear(); }
+
+ private:
+  struct Sample {
+    double device_s;  // device time since origin
+    double offset_s;  // host time since origin minus device_s
+  };
+
+  void Fit();
+
+  size_t window_;
+  std::deque<Sample> samples_;
+  int64_t origin_device_us_{0};
+  double origin_host_s_{0};
+  double skew_{0};
+  double offset_s_{0};
+};
+
+}  // namespace bluefox2
+
+#endif  // BLUEFOX2_CLOCK_SYNC_H_
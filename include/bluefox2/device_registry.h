@@ -0,0 +1,58 @@
+#ifndef BLUEFOX2_DEVICE_REGISTRY_H_
+#define BLUEFOX2_DEVICE_REGISTRY_H_
+
+#ifndef linux
+#define linux
+#endif
+#include <mvIMPACT_CPP/mvIMPACT_acquire.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace bluefox2 {
+
+/**
+ * @brief The DeviceRegistry class
+ * Process wide owner of the DeviceManager, so that the usb bus is enumerated
+ * once no matter how many cameras a process drives
+ */
+class DeviceRegistry {
+ public:
+  static DeviceRegistry &Instance();
+
+  DeviceRegistry(const DeviceRegistry &) = delete;
+  DeviceRegistry &operator=(const DeviceRegistry &) = delete;
+
+  /**
+   * @brief Open Find a device by serial and open it if it is not open yet
+   * @param serial Serial number of the device
+   * @return Opened device, throws if it is not found or cannot be opened
+   */
+  mvIMPACT::acquire::Device *Open(const std::string &serial);
+
+  /**
+   * @brief OpenAll Open several devices concurrently
+   * @param serials Serial numbers of the devices
+   * @return Time in s it took to open each device, throws the first error
+   * after all devices have been tried
+   */
+  std::map<std::string, double> OpenAll(
+      const std::vector<std::string> &serials);
+
+  std::string AvailableDevices();
+
+ private:
+  DeviceRegistry() = default;
+
+  mvIMPACT::acquire::Device *Find(const std::string &serial);
+
+  // Guards the device list, opening itself runs unlocked
+  std::mutex mutex_;
+  mvIMPACT::acquire::DeviceManager dev_mgr_;
+};
+
+}  // namespace bluefox2
+
+#endif  // BLUEFOX2_DEVICE_REGISTRY_H_
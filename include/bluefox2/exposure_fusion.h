@@ -0,0 +1,48 @@
+#ifndef BLUEFOX2_EXPOSURE_FUSION_H_
+#define BLUEFOX2_EXPOSURE_FUSION_H_
+
+#include <sensor_msgs/Image.h>
+
+#include <vector>
+
+namespace bluefox2 {
+
+/**
+ * @brief The ExposureFusion class
+ * Fuses the frames of an exposure bracket into one image. Every sample is the
+ * average of its values across the bracket, weighted by how far they are
+ * from black and white, so each part of the image is taken from the frames
+ * that expose it best. Only 8 bit encodings are fused.
+ */
+class ExposureFusion {
+ public:
+  /**
+   * @brief Add Add the next frame of a bracket
+   * @param image_msg Image of the frame
+   * @param bracket Index of the frame in the bracket
+   * @param bracket_count Number of frames in the bracket
+   * @param fused_msg Fused image, stamped in the middle of the bracket
+   * @return True if the frame completed a bracket and fused_msg was written
+   */
+  bool Add(const sensor_msgs::Image &image_msg, int bracket, int bracket_count,
+           sensor_msgs::Image &fused_msg);
+  void Reset() { next_ = 0; }
+
+ private:
+  bool Start(const sensor_msgs::Image &image_msg);
+  bool Matches(const sensor_msgs::Image &image_msg) const;
+  void Accumulate(const sensor_msgs::Image &image_msg);
+  void Compose(const sensor_msgs::Image &image_msg,
+               sensor_msgs::Image &fused_msg) const;
+
+  // Index of the frame that continues the current bracket, 0 if none
+  int next_{0};
+  ros::Time stamp_;
+  std::string encoding_;
+  std::vector<float> sum_;
+  std::vector<float> weight_sum_;
+};
+
+}  // namespace bluefox2
+
+#endif  // BLUEFOX2_EXPOSURE_FUSION_H_
@@ -0,0 +1,27 @@
+#ifndef BLUEFOX2_FRAME_METADATA_H_
+#define BLUEFOX2_FRAME_METADATA_H_
+
+#include <cstdint>
+
+namespace bluefox2 {
+
+/**
+ * @brief The FrameMetadata struct Per frame values reported by the driver
+ * Read while the request is locked, so they belong to exactly one image
+ */
+struct FrameMetadata {
+  int64_t frame_nr{-1};
+  int64_t expose_start_us{0};  // camera clock
+  int expose_us{0};
+  double gain_db{0};
+  int transfer_delay_us{0};
+  // Digital inputs, one bit per pin, 0 if the camera does not report them
+  int io_states_start{0};
+  int io_states_end{0};
+  // Index of the exposure in the bracket, -1 when not bracketing
+  int bracket{-1};
+};
+
+}  // namespace bluefox2
+
+#endif  // BLUEFOX2_FRAME_METADATA_H_
@@ -0,0 +1,81 @@
+#ifndef BLUEFOX2_FRAME_SCHEDULER_H_
+#define BLUEFOX2_FRAME_SCHEDULER_H_
+
+#include "bluefox2/latency.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace bluefox2 {
+
+/**
+ * @brief The FrameScheduler class
+ * Paces on demand triggers on a fixed grid of absolute deadlines, so time
+ * spent grabbing and publishing does not add to the period. A loop that falls
+ * behind skips the slots it missed instead of firing a burst to catch up.
+ */
+class FrameScheduler {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  /**
+   * @brief FrameScheduler
+   * @param fps Frames per second, 0 or less does not wait at all
+   * @param align Put the grid on multiples of the period since the epoch of
+   * the system clock, so that hosts with synchronized clocks fire in phase
+   * @param offset Delay of every deadline after its slot, less than a period
+   */
+  FrameScheduler(double fps, bool align,
+                 Clock::duration offset = Clock::duration::zero());
+
+  /**
+   * @brief Wait Sleep until the next deadline
+   * @return The deadline that was waited for
+   */
+  Clock::time_point Wait();
+  /**
+   * @brief set_origin Start of slot 0 for grids that are not aligned
+   * Schedulers sharing an origin keep their offsets to each other, otherwise
+   * each grid starts at its first Wait
+   */
+  void set_origin(const Clock::time_point &origin) {
+    origin_ = origin;
+    shared_origin_ = true;
+  }
+  /**
+   * @brief Pause Sleep for a short while instead of waiting for a deadline
+   * The next call to Wait starts the grid again instead of counting the
+   * slots missed while paused as overruns
+   */
+  void Pause();
+
+  /**
+   * @brief jitter How late Wait returned after each deadline in us
+   */
+  Histogram &jitter() { return jitter_; }
+  /**
+   * @brief overruns Number of slots skipped since the start
+   */
+  int64_t overruns() const { return overruns_; }
+
+ private:
+  /**
+   * @brief GridTime Time on the grid, slot n starts at n periods
+   */
+  Clock::duration GridTime(const Clock::time_point &now) const;
+
+  Clock::duration period_{0};
+  bool align_{false};
+  Clock::duration offset_{0};
+  bool started_{false};
+  bool shared_origin_{false};
+  Clock::time_point origin_;
+  int64_t next_slot_{0};
+  Histogram jitter_;
+  std::atomic<int64_t> overruns_{0};
+};
+
+}  // namespace bluefox2
+
+#endif  // BLUEFOX2_FRAME_SCHEDULER_H_
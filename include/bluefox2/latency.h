@@ -0,0 +1,106 @@
+#ifndef BLUEFOX2_LATENCY_H_
+#define BLUEFOX2_LATENCY_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace bluefox2 {
+
+using LatencyClock = std::chrono::steady_clock;
+
+/**
+ * @brief The Histogram class
+ * Lock-free histogram of durations in us with log-linear buckets, each power
+ * of two is split into 8 buckets, so percentiles are within 12.5%. Recording
+ * and reading may happen on different threads.
+ */
+class Histogram {
+ public:
+  static constexpr int kSubBits = 3;
+  static constexpr int kSubBuckets = 1 << kSubBits;
+  // Up to 2^40 us, which is more than 12 days
+  static constexpr int kMaxBits = 40;
+  static constexpr int kBuckets = kSubBuckets * (kMaxBits - kSubBits + 1);
+
+  Histogram() { Reset(); }
+
+  void Record(int64_t us);
+
+  /**
+   * @brief Percentile
+   * @param p Percentile in [0, 1]
+   * @return Midpoint of the bucket containing the percentile, 0 if empty
+   */
+  int64_t Percentile(double p) const;
+
+  int64_t max() const { return max_.load(std::memory_order_relaxed); }
+  uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+
+  /**
+   * @brief Reset Clear all buckets
+   * Samples recorded concurrently with a reset may be partially cleared
+   */
+  void Reset();
+
+ private:
+  static int Bucket(int64_t us);
+  static int64_t BucketLow(int bucket);
+
+  std::array<std::atomic<uint32_t>, kBuckets> buckets_;
+  std::atomic<uint64_t> count_;
+  std::atomic<int64_t> max_;
+};
+
+/**
+ * @brief The LatencyStage enum Probes along the capture pipeline
+ */
+enum class LatencyStage {
+  kRequest,    // imageRequestSingle
+  kWait,       // imageRequestWaitFor
+  kFrameInfo,  // metadata, image format and calibration steps of a request
+  kCopy,       // copy or swap into the image message
+  kPublish,    // image transport publish
+  kCount
+};
+
+const char *LatencyStageName(LatencyStage stage);
+
+/**
+ * @brief The LatencyStats class
+ * One histogram per stage of the capture pipeline of a camera
+ */
+class LatencyStats {
+ public:
+  /**
+   * @brief Record Record the time since start for a stage
+   * @return Current time, to be used as start of the next stage
+   */
+  LatencyClock::time_point Record(LatencyStage stage,
+                                  const LatencyClock::time_point &start) {
+    const auto now = LatencyClock::now();
+    histogram(stage).Record(
+        std::chrono::duration_cast<std::chrono::microseconds>(now - start)
+            .count());
+    return now;
+  }
+
+  Histogram &histogram(LatencyStage stage) {
+    return histograms_[static_cast<int>(stage)];
+  }
+  const Histogram &histogram(LatencyStage stage) const {
+    return histograms_[static_cast<int>(stage)];
+  }
+
+  void Reset() {
+    for (Histogram &h : histograms_) h.Reset();
+  }
+
+ private:
+  std::array<Histogram, static_cast<int>(LatencyStage::kCount)> histograms_;
+};
+
+}  // namespace bluefox2
+
+#endif  // BLUEFOX2_LATENCY_H_
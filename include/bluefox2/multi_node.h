@@ -2,22 +2,62 @@
 #define BLUEFOX2_MULTI_NODE_H_
 
 #include "bluefox2/Bluefox2DynConfig.h"
+#include "bluefox2/frame_scheduler.h"
 #include <camera_base/camera_node_base.h>
 
+#include <memory>
+
 namespace bluefox2 {
 
 class Bluefox2Ros;
+class RigExposure;
+class StampBarrier;
 using Bluefox2RosPtr = boost::shared_ptr<Bluefox2Ros>;
 
 class MultiNode : public camera_base::CameraNodeBase<Bluefox2DynConfig> {
  public:
   explicit MultiNode(const ros::NodeHandle &pnh);
+  ~MultiNode();
 
   virtual void Acquire() override;
   virtual void Setup(Bluefox2DynConfig &config) override;
 
  private:
+  void AcquireCamera(const Bluefox2RosPtr &bf2_ros, StampBarrier *barrier,
+                     double offset_us);
+  /**
+   * @brief AcquireCameraStream Grab a hardware timed camera from its stream
+   */
+  void AcquireCameraStream(const Bluefox2RosPtr &bf2_ros,
+                           StampBarrier *barrier);
+  /**
+   * @brief HasSubscribers Whether any camera of the rig is listened to
+   */
+  bool HasSubscribers() const;
+  /**
+   * @brief PlanUsb Share the usb bus between the configured cameras
+   * @param config Reconfigure config, reports a lowered pixel clock back
+   * @param configs Config each camera was configured with
+   */
+  void PlanUsb(Bluefox2DynConfig &config,
+               std::vector<Bluefox2DynConfig> &configs);
+
   std::vector<Bluefox2RosPtr> multi_ros_;
+  // Cpu core each capture thread is pinned to, -1 for no pinning
+  std::vector<int> multi_cpu_;
+  // Whether the camera is published together with the other synced cameras
+  std::vector<bool> multi_sync_;
+  // Delay of the trigger of each camera in its frame period
+  std::vector<double> multi_offset_us_;
+  // Common start of the trigger grids, so the offsets hold between cameras
+  FrameScheduler::Clock::time_point rig_origin_;
+  // Bandwidth of the usb bus the cameras share in MB/s, 0 for no budget
+  double usb_budget_mbps_{0};
+  // Put the trigger grids on multiples of the period of the system clock
+  bool align_triggers_{false};
+  // Run aec on the host with one exposure for the whole rig
+  bool rig_aec_{false};
+  std::unique_ptr<RigExposure> rig_exposure_;
 };
 
 }  // namespace bluefox2
@@ -0,0 +1,82 @@
+#ifndef BLUEFOX2_RIG_EXPOSURE_H_
+#define BLUEFOX2_RIG_EXPOSURE_H_
+
+#include "bluefox2/Bluefox2DynConfig.h"
+#include "bluefox2/frame_metadata.h"
+#include <sensor_msgs/Image.h>
+
+#include <mutex>
+#include <vector>
+
+namespace bluefox2 {
+
+class CameraBackend;
+
+/**
+ * @brief The BrightnessStats struct Brightness of an image in [0, 1]
+ */
+struct BrightnessStats {
+  double mean{0};
+  // Fraction of the samples that are close to white
+  double clipped{0};
+  size_t samples{0};
+};
+
+/**
+ * @brief MeasureBrightness Brightness of every row_stride-th row of an image
+ * @return Empty stats for encodings that are not 8 bit
+ */
+BrightnessStats MeasureBrightness(const sensor_msgs::Image &image_msg,
+                                  int row_stride = 4);
+
+/**
+ * @brief The RigExposure class
+ * Auto exposure on the host for a rig of cameras. Once every camera has
+ * delivered a frame, their brightness is combined and one exposure and gain
+ * is written to all of them, so the rig stays matched instead of each sensor
+ * converging on its own. Each step scales exposure times gain by a damped
+ * ratio of target and measured brightness, based on the values the frames
+ * were actually taken with.
+ */
+class RigExposure {
+ public:
+  explicit RigExposure(const std::vector<CameraBackend *> &cameras);
+
+  /**
+   * @brief Configure Take the target and limits from a config
+   * @param config des_grey_value is the target, agc whether gain is
+   * controlled as well, and expose_us and gain_db are the starting point
+   * @param fps Exposure is kept below the frame period
+   */
+  void Configure(const Bluefox2DynConfig &config, double fps);
+
+  /**
+   * @brief Add Add a grabbed frame, called from the capture threads
+   * @param index Index of the camera in the rig
+   */
+  void Add(size_t index, const sensor_msgs::Image &image_msg,
+           const FrameMetadata &metadata);
+
+ private:
+  struct Sample {
+    BrightnessStats stats;
+    double expose_us{0};
+    double gain_db{0};
+    bool fresh{false};
+  };
+
+  bool Step(int &expose_us, double &gain_db);
+
+  std::vector<CameraBackend *> cameras_;
+  std::mutex mutex_;
+  std::vector<Sample> samples_;
+  size_t fresh_{0};
+  double target_{85.0 / 255};
+  bool auto_gain_{false};
+  double fixed_gain_db_{0};
+  double max_expose_us_{100000};
+};
+
+}  // namespace bluefox2
+
+#endif  // BLUEFOX2_RIG_EXPOSURE_H_
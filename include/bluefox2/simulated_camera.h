@@ -0,0 +1,110 @@
+#ifndef BLUEFOX2_SIMULATED_CAMERA_H_
+#define BLUEFOX2_SIMULATED_CAMERA_H_
+
+#include "bluefox2/camera_backend.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace bluefox2 {
+
+/**
+ * @brief The SimulatedCamera class
+ * Camera backend without hardware. Requests complete the way they would on
+ * the sensor: on demand requests after exposure and latency, the other
+ * trigger modes on a grid at fps. Frames are either a moving test pattern
+ * whose brightness follows exposure and gain, or recorded frames replayed
+ * in a loop.
+ */
+class SimulatedCamera : public CameraBackend {
+ public:
+  /**
+   * @brief SimulatedCamera
+   * @param serial Name reported as serial number
+   * @param latency_ms Time from the end of the exposure until the frame
+   * arrives, standing in for readout and usb transfer
+   * @param replay Directory of binary pgm or ppm files replayed in order of
+   * their names, empty for the test pattern
+   */
+  SimulatedCamera(const std::string &serial, double latency_ms,
+                  const std::string &replay = std::string());
+
+  const std::string &serial() const override { return serial_; }
+  bool hardware_timed() const override {
+    return config_.ctm == Bluefox2Dyn_ctm_hardware_timed;
+  }
+  bool hw_stamp() const override { return hw_stamp_; }
+  void set_hw_stamp(bool hw_stamp) override { hw_stamp_ = hw_stamp; }
+  void set_user_buffer(bool) override {}
+  void set_calibration_cache(const std::string &) override {}
+  int bracket_count() const override { return 1; }
+  std::vector<int> pixel_clocks() const override;
+  LatencyStats &latency() const override { return latency_; }
+  Bluefox2Stats GetStats() const override;
+  size_t replay_size() const { return replay_.size(); }
+
+  int64_t SetExpose(int &expose_us, double &gain_db, bool set_gain,
+                    int timeout_ms) override;
+
+  void RequestSingle() const override;
+  void Configure(Bluefox2DynConfig &config) override;
+  bool GrabImage(sensor_msgs::Image &image_msg,
+                 FrameMetadata *metadata = nullptr) override;
+
+  void StartStreaming() override;
+  void StopStreaming() override { streaming_ = false; }
+  void CancelRequests() override;
+  void SetRequestCount(int &request_count) const override;
+
+  void SetMM(int) const override {}
+  void SetMaster() const override {}
+  void SetSlave() const override {}
+
+ private:
+  using Clock = LatencyClock;
+
+  struct Request {
+    int64_t frame_nr;
+    Clock::time_point expose_start;
+    Clock::time_point ready;
+    int expose_us;
+    double gain_db;
+  };
+
+  // Queues a request, the caller holds mutex_
+  bool QueueRequest() const;
+  void LoadReplay(const std::string &dir);
+  void Render(const Request &request, sensor_msgs::Image &image_msg) const;
+
+  std::string serial_;
+  Clock::duration transfer_delay_{0};
+  const Clock::time_point origin_;
+  int timeout_ms_{200};
+  bool hw_stamp_{false};
+  std::atomic<bool> streaming_{false};
+  Bluefox2DynConfig config_;
+  std::string encoding_;
+  std::vector<sensor_msgs::Image> replay_;
+
+  // Requests and the values they are taken with, guarded by mutex_
+  mutable std::mutex mutex_;
+  mutable std::condition_variable cond_;
+  mutable std::deque<Request> queue_;
+  mutable int64_t next_frame_nr_{0};
+  mutable Clock::time_point last_expose_start_;
+  mutable int request_count_{4};
+  int expose_us_{10000};
+  double gain_db_{0};
+
+  mutable LatencyStats latency_;
+  std::atomic<int64_t> frame_count_{0};
+  std::atomic<int64_t> wait_timeouts_{0};
+  mutable std::atomic<int64_t> failed_requests_{0};
+};
+
+}  // namespace bluefox2
+
+#endif  // BLUEFOX2_SIMULATED_CAMERA_H_
@@ -3,6 +3,11 @@
 
 #include "bluefox2/Bluefox2DynConfig.h"
 #include <camera_base/camera_node_base.h>
+#include <sensor_msgs/Image.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 
 namespace bluefox2 {
 
@@ -18,8 +23,20 @@ class SingleNode : public camera_base::CameraNodeBase<Bluefox2DynConfig> {
   void AcquireOnce();
 
  private:
+  void AcquireStream();
+  void PublishStream();
+
   boost::shared_ptr<Bluefox2Ros> bluefox2_ros_;
   bool boost_{false};
+  // Put the trigger grid on multiples of the period of the system clock
+  bool align_triggers_{false};
+
+  // Stream
+  bool stream_{false};
+  bool publishing_{false};
+  std::mutex frames_mutex_;
+  std::condition_variable frames_cond_;
+  std::deque<sensor_msgs::ImagePtr> frames_;
 };
 
 }  // namespace bluefox2
@@ -2,6 +2,7 @@
 #define BLUEFOX2_STEREO_NODE_H_
 
 #include "bluefox2/Bluefox2DynConfig.h"
+#include "bluefox2/stereo_pairer.h"
 #include <camera_base/camera_node_base.h>
 
 namespace bluefox2 {
@@ -18,8 +19,22 @@ class StereoNode : public camera_base::CameraNodeBase<Bluefox2DynConfig> {
   void AcquireOnce();
 
  private:
+  /**
+   * @brief AcquirePaired Grab both cameras and publish the images that match
+   * For a hardware synced slave of a host triggered or hardware timed master
+   */
+  void AcquirePaired();
+  bool HasSubscribers() const;
+  void PublishPair(const StereoPair &pair);
+
   boost::shared_ptr<Bluefox2Ros> left_ros_;
   boost::shared_ptr<Bluefox2Ros> right_ros_;
+
+  // Hardware sync
+  bool sync_{false};
+  double sync_tolerance_ms_{0};
+  // Put the trigger grid on multiples of the period of the system clock
+  bool align_triggers_{false};
 };
 
 }  // namespace bluefox2
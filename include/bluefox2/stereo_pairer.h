@@ -0,0 +1,60 @@
+#ifndef BLUEFOX2_STEREO_PAIRER_H_
+#define BLUEFOX2_STEREO_PAIRER_H_
+
+#include "bluefox2/frame_metadata.h"
+#include <sensor_msgs/Image.h>
+
+#include <cstddef>
+#include <deque>
+
+namespace bluefox2 {
+
+struct StereoFrame {
+  sensor_msgs::ImagePtr image;
+  FrameMetadata metadata;
+};
+
+struct StereoPair {
+  StereoFrame left;
+  StereoFrame right;
+};
+
+/**
+ * @brief The StereoPairer class
+ * Matches left and right images of a hardware synced stereo rig by time
+ * stamp. Images that arrive before their partner wait in a small ring, and
+ * images that can no longer be matched are dropped instead of being paired
+ * with the wrong partner.
+ */
+class StereoPairer {
+ public:
+  explicit StereoPairer(size_t capacity = 4) : capacity_(capacity) {}
+
+  /**
+   * @brief AddLeft Add a left image
+   * @param frame Left image with time stamp and its metadata
+   * @param pair Completed pair, both images stamped with the left stamp
+   * @return True if the image completed a pair
+   */
+  bool AddLeft(const StereoFrame &frame, StereoPair &pair);
+  bool AddRight(const StereoFrame &frame, StereoPair &pair);
+
+  const ros::Duration &tolerance() const { return tolerance_; }
+  void set_tolerance(const ros::Duration &tolerance) { tolerance_ = tolerance; }
+  size_t dropped() const { return dropped_; }
+  void Reset();
+
+ private:
+  bool Add(const StereoFrame &frame, std::deque<StereoFrame> &own,
+           std::deque<StereoFrame> &other, StereoFrame &partner);
+
+  size_t capacity_;
+  size_t dropped_{0};
+  ros::Duration tolerance_{0.005};
+  std::deque<StereoFrame> left_;
+  std::deque<StereoFrame> right_;
+};
+
+}  // namespace bluefox2
+
+#endif  // BLUEFOX2_STEREO_PAIRER_H_
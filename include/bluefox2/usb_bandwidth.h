@@ -0,0 +1,87 @@
+#ifndef BLUEFOX2_USB_BANDWIDTH_H_
+#define BLUEFOX2_USB_BANDWIDTH_H_
+
+#include "bluefox2/Bluefox2DynConfig.h"
+
+#include <vector>
+
+namespace bluefox2 {
+
+/**
+ * @brief The UsbDemand struct What a camera asks of the usb bus
+ * The sensor streams one pixel per clock while it reads out, so a frame
+ * occupies the bus for the readout time at the rate of the pixel clock
+ */
+struct UsbDemand {
+  int width{0};
+  int height{0};
+  int bytes_per_pixel{1};
+  int pclk_khz{0};
+  double fps{0};
+  double expose_us{0};
+  // Pixel clocks the camera supports, the plan only lowers to these
+  std::vector<int> pclks_khz;
+};
+
+/**
+ * @brief MakeUsbDemand Demand of a camera configured with config
+ * @param config Config after Configure, so that the AOI and pixel clock are
+ * the ones that were applied
+ */
+UsbDemand MakeUsbDemand(const Bluefox2DynConfig &config,
+                        const std::vector<int> &pclks_khz);
+
+/**
+ * @brief TransferTimeUs Time a frame occupies the bus
+ */
+double TransferTimeUs(const UsbDemand &demand);
+/**
+ * @brief PeakRateMBps Rate while a frame is transferred in MB/s
+ */
+double PeakRateMBps(const UsbDemand &demand);
+/**
+ * @brief MeanRateMBps Rate averaged over a frame period in MB/s
+ */
+double MeanRateMBps(const UsbDemand &demand);
+
+/**
+ * @brief The UsbSlot struct Planned pixel clock and trigger of one camera
+ */
+struct UsbSlot {
+  int pclk_khz{0};
+  // Delay of the trigger after the start of the frame period
+  double offset_us{0};
+  double transfer_us{0};
+  double peak_mbps{0};
+  double mean_mbps{0};
+};
+
+/**
+ * @brief The UsbPlan struct How the cameras of a rig share a bus
+ */
+struct UsbPlan {
+  std::vector<UsbSlot> slots;
+  // Highest rate of the transfers that overlap
+  double peak_mbps{0};
+  double mean_mbps{0};
+  bool staggered{false};
+  bool within_budget{true};
+};
+
+/**
+ * @brief PlanUsbBandwidth Keep the cameras on one bus under a budget
+ * Cameras that fit the budget together keep their clocks and are triggered
+ * at once. Otherwise their triggers are staggered so the transfers follow
+ * each other within a frame period, if stagger is allowed and they fit.
+ * Failing that, the highest pixel clocks are lowered one step at a time as
+ * long as every camera still reaches its fps.
+ * @param budget_mbps Bandwidth of the bus in MB/s
+ * @param stagger Whether triggers may be offset, which only holds for on
+ * demand triggers and cameras that do not share a time stamp
+ */
+UsbPlan PlanUsbBandwidth(const std::vector<UsbDemand> &demands,
+                         double budget_mbps, bool stagger);
+
+}  // namespace bluefox2
+
+#endif  // BLUEFOX2_USB_BANDWIDTH_H_
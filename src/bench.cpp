@@ -0,0 +1,356 @@
+#include <iostream>
+#include <boost/program_options.hpp>
+#include <boost/make_shared.hpp>
+#include <sensor_msgs/fill_image.h>
+#include <sensor_msgs/image_encodings.h>
+
+#include "bluefox2/bluefox2_setting.h"
+#include "bluefox2/device_registry.h"
+#include "bluefox2/exposure_fusion.h"
+#include "bluefox2/rig_exposure.h"
+#include "bluefox2/simulated_camera.h"
+
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <iomanip>
+
+using namespace bluefox2;
+using namespace mvIMPACT::acquire;
+namespace bpo = boost::program_options;
+namespace enc = sensor_msgs::image_encodings;
+
+/**
+ * @brief DoNotOptimize Keep the compiler from dropping a computed value
+ */
+template <typename T>
+inline void DoNotOptimize(const T& value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+struct BenchResult {
+  std::string name;
+  int64_t iterations{0};
+  double ns_median{0};
+  double ns_min{0};
+  double bytes_per_iteration{0};
+};
+
+/**
+ * @brief The Bench class
+ * Runs a function in batches long enough to time reliably and keeps the
+ * median and the best of a few repetitions
+ */
+class Bench {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  Bench(const std::string& filter, double min_time_s)
+      : filter_(filter), min_time_s_(min_time_s) {}
+
+  /**
+   * @brief Run Time fn unless its name does not match the filter
+   * @param bytes Bytes processed per call, 0 if throughput makes no sense
+   */
+  template <typename Fn>
+  void Run(const std::string& name, Fn fn, double bytes = 0) {
+    static const int kRepetitions = 5;
+    if (name.find(filter_) == std::string::npos) return;
+
+    // Grow the batch until it takes a fair share of min_time
+    const double batch_time_s = min_time_s_ / kRepetitions;
+    int64_t batch = 1;
+    double elapsed_s = 0;
+    while (true) {
+      elapsed_s = TimeBatch(fn, batch);
+      if (elapsed_s >= batch_time_s || batch >= (int64_t(1) << 40)) break;
+      const double scale = elapsed_s > 0 ? batch_time_s / elapsed_s : 10;
+      batch = static_cast<int64_t>(batch *
+                                   std::min(std::max(scale, 2.0), 10.0));
+    }
+
+    std::vector<double> ns_per_iteration;
+    for (int i = 0; i < kRepetitions; ++i) {
+      ns_per_iteration.push_back(TimeBatch(fn, batch) * 1e9 / batch);
+    }
+    std::sort(ns_per_iteration.begin(), ns_per_iteration.end());
+
+    BenchResult result;
+    result.name = name;
+    result.iterations = batch * kRepetitions;
+    result.ns_median = ns_per_iteration[kRepetitions / 2];
+    result.ns_min = ns_per_iteration.front();
+    result.bytes_per_iteration = bytes;
+    results_.push_back(result);
+    std::cerr << std::left << std::setw(48) << name << std::right
+              << std::setw(14) << std::fixed << std::setprecision(1)
+              << result.ns_median << " ns" << std::endl;
+  }
+
+  const std::vector<BenchResult>& results() const { return results_; }
+
+ private:
+  template <typename Fn>
+  static double TimeBatch(Fn& fn, int64_t batch) {
+    const auto start = Clock::now();
+    for (int64_t i = 0; i < batch; ++i) {
+      fn();
+    }
+    return std::chrono::duration<double>(Clock::now() - start).count();
+  }
+
+  std::string filter_;
+  double min_time_s_;
+  std::vector<BenchResult> results_;
+};
+
+struct Resolution {
+  uint32_t width;
+  uint32_t height;
+};
+
+std::string FormatName(const Resolution& res, const std::string& encoding) {
+  return std::to_string(res.width) + "x" + std::to_string(res.height) + "/" +
+         encoding;
+}
+
+// Full sensor of the 200w, the same binned and the 1.2 MP sensors
+const std::vector<Resolution> kResolutions = {
+    {376, 240}, {752, 480}, {1280, 960}};
+const std::vector<std::string> kEncodings = {enc::MONO8, enc::MONO16,
+                                             enc::BGR8};
+
+void BenchImages(Bench& bench) {
+  for (const Resolution& res : kResolutions) {
+    for (const std::string& encoding : kEncodings) {
+      const uint32_t step =
+          res.width * enc::numChannels(encoding) * enc::bitDepth(encoding) / 8;
+      const size_t size = step * res.height;
+      const std::string format = FormatName(res, encoding);
+      std::vector<uint8_t> request_data(size, 128);
+
+      // GrabImage copying out of driver allocated memory
+      sensor_msgs::Image image_msg;
+      bench.Run("fill_image/" + format, [&] {
+        sensor_msgs::fillImage(image_msg, encoding, res.height, res.width,
+                               step, request_data.data());
+        DoNotOptimize(image_msg.data.data());
+      }, size);
+
+      // GrabImage with user buffers, storage is swapped instead of copied
+      std::vector<uint8_t> buffer(size);
+      bench.Run("swap_buffer/" + format, [&] {
+        std::swap(image_msg.data, buffer);
+        image_msg.data.resize(size);
+        DoNotOptimize(image_msg.data.data());
+      }, size);
+
+      // A new message per frame against the pool of Bluefox2Ros
+      bench.Run("alloc_image/" + format, [&] {
+        const auto msg = boost::make_shared<sensor_msgs::Image>();
+        msg->data.resize(size);
+        DoNotOptimize(msg->data.data());
+      }, size);
+      std::vector<sensor_msgs::ImagePtr> pool(4);
+      for (auto& msg : pool) {
+        msg = boost::make_shared<sensor_msgs::Image>();
+      }
+      bench.Run("pool_image/" + format, [&] {
+        for (const auto& msg : pool) {
+          if (msg.use_count() == 1) {
+            msg->data.resize(size);
+            DoNotOptimize(msg->data.data());
+            break;
+          }
+        }
+      }, size);
+
+      if (enc::bitDepth(encoding) != 8) continue;
+      image_msg.encoding = encoding;
+      image_msg.width = res.width;
+      image_msg.height = res.height;
+      image_msg.step = step;
+      image_msg.data.assign(size, 128);
+      bench.Run("measure_brightness/" + format, [&] {
+        DoNotOptimize(MeasureBrightness(image_msg).mean);
+      }, size);
+      ExposureFusion fusion;
+      sensor_msgs::Image fused_msg;
+      int bracket = 0;
+      bench.Run("exposure_fusion/" + format, [&] {
+        DoNotOptimize(fusion.Add(image_msg, bracket, 3, fused_msg));
+        bracket = (bracket + 1) % 3;
+      }, size);
+    }
+  }
+}
+
+void BenchSimulatedCamera(Bench& bench) {
+  for (const Resolution& res : kResolutions) {
+    for (const std::string& encoding : kEncodings) {
+      // No latency and a tiny exposure, so only the host side is timed
+      SimulatedCamera camera("sim", 0);
+      auto config = Bluefox2DynConfig::__getDefault__();
+      config.width = res.width;
+      config.height = res.height;
+      config.expose_us = 10;
+      config.ctm = Bluefox2Dyn_ctm_on_demand;
+      config.idpf = encoding == enc::MONO16
+                        ? Bluefox2Dyn_idpf_mono16
+                        : encoding == enc::BGR8 ? Bluefox2Dyn_idpf_bgr888_packed
+                                                : Bluefox2Dyn_idpf_mono8;
+      config.request = 0;
+      camera.Configure(config);
+      sensor_msgs::Image image_msg;
+      FrameMetadata metadata;
+      bench.Run("sim_grab/" + FormatName(res, encoding), [&] {
+        camera.RequestSingle();
+        DoNotOptimize(camera.GrabImage(image_msg, &metadata));
+      });
+    }
+  }
+}
+
+void BenchSettings(Bench& bench) {
+  const std::vector<TImageBufferPixelFormat> pixel_formats = {
+      ibpfMono8, ibpfMono16, ibpfRGBx888Packed, ibpfRGB888Packed,
+      ibpfBGR888Packed, ibpfRGB161616Packed};
+  bench.Run("pixel_format_to_encoding", [&] {
+    for (const auto pixel_format : pixel_formats) {
+      DoNotOptimize(&PixelFormatToEncoding(pixel_format));
+    }
+  });
+
+  const std::vector<TBayerMosaicParity> bayer_patterns = {bmpRG, bmpGB, bmpGR,
+                                                          bmpBG};
+  bench.Run("bayer_pattern_to_encoding", [&] {
+    for (const auto bayer_pattern : bayer_patterns) {
+      DoNotOptimize(&BayerPatternToEncoding(bayer_pattern, 1));
+      DoNotOptimize(&BayerPatternToEncoding(bayer_pattern, 2));
+    }
+  });
+
+  const std::vector<int> pixel_clocks = {12000, 20000, 24000, 27000,
+                                         32000, 40000, 50000};
+  bench.Run("pixel_clock_to_frame_rate", [&] {
+    for (const int pclk_khz : pixel_clocks) {
+      for (const Resolution& res : kResolutions) {
+        DoNotOptimize(
+            PixelClockToFrameRate(pclk_khz, res.width, res.height, 10000));
+      }
+    }
+  });
+}
+
+void BenchProperties(Bench& bench, const std::string& serial) {
+  Device* dev = DeviceRegistry::Instance().Open(serial);
+  CameraSettingsBlueFOX cam_set(dev);
+  int expose_us = 10000;
+  ReadProperty(cam_set.expose_us, expose_us);
+  bench.Run("read_property/expose_us", [&] {
+    ReadProperty(cam_set.expose_us, expose_us);
+    DoNotOptimize(expose_us);
+  });
+  bench.Run("write_and_read_property/expose_us", [&] {
+    WriteAndReadProperty(cam_set.expose_us, expose_us);
+    DoNotOptimize(expose_us);
+  });
+}
+
+void PrintJson(const std::vector<BenchResult>& results, double min_time_s) {
+  const std::time_t now = std::time(nullptr);
+  char date[32];
+  std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::localtime(&now));
+  std::cout << "{\n  \"context\": {\n    \"date\": \"" << date
+            << "\",\n    \"min_time_s\": " << min_time_s
+            << "\n  },\n  \"benchmarks\": [";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const BenchResult& result = results[i];
+    std::cout << (i ? "," : "") << "\n    {\"name\": \"" << result.name
+              << "\", \"iterations\": " << result.iterations
+              << ", \"real_time\": " << result.ns_median
+              << ", \"real_time_min\": " << result.ns_min
+              << ", \"time_unit\": \"ns\"";
+    if (result.bytes_per_iteration > 0) {
+      std::cout << ", \"bytes_per_second\": "
+                << result.bytes_per_iteration * 1e9 / result.ns_median;
+    }
+    std::cout << "}";
+  }
+  std::cout << "\n  ]\n}" << std::endl;
+}
+
+void PrintCsv(const std::vector<BenchResult>& results) {
+  std::cout << "name,iterations,real_time,real_time_min,time_unit,"
+               "bytes_per_second\n";
+  for (const BenchResult& result : results) {
+    std::cout << result.name << "," << result.iterations << ","
+              << result.ns_median << "," << result.ns_min << ",ns,";
+    if (result.bytes_per_iteration > 0) {
+      std::cout << result.bytes_per_iteration * 1e9 / result.ns_median;
+    }
+    std::cout << "\n";
+  }
+  std::cout << std::flush;
+}
+
+void PrintUsage() {
+  std::cout << "bluefox2_bench times the per frame code paths of the driver"
+               " and prints the results as json or csv.\n\n"
+            << "usage:\n"
+            << "  rosrun bluefox2 bluefox2_bench [options]\n\n";
+}
+
+int main(int argc, char** argv) {
+  // Grabbing stamps images with ros time, which runs on the wall clock
+  // outside of a node
+  ros::Time::init();
+
+  bpo::options_description opt_desc("Options");
+  opt_desc.add_options()("help", "Show help text.")(
+      "filter", bpo::value<std::string>()->default_value(""),
+      "Only run benchmarks whose name contains this.")(
+      "format", bpo::value<std::string>()->default_value("json"),
+      "Output format, json or csv.")(
+      "min_time", bpo::value<double>()->default_value(0.5),
+      "Time in s spent on each benchmark.")(
+      "serial", bpo::value<std::string>(),
+      "Open this camera to time property access as well.");
+  bpo::variables_map var_map;
+  try {
+    bpo::store(bpo::parse_command_line(argc, argv, opt_desc), var_map);
+    bpo::notify(var_map);
+  } catch (const std::exception& e) {
+    std::cout << e.what() << "\n\n";
+    PrintUsage();
+    std::cout << opt_desc << "\n";
+    return 1;
+  }
+  if (var_map.count("help")) {
+    PrintUsage();
+    std::cout << opt_desc << "\n";
+    return 0;
+  }
+
+  const auto format = var_map["format"].as<std::string>();
+  const auto min_time_s = var_map["min_time"].as<double>();
+  Bench bench(var_map["filter"].as<std::string>(), min_time_s);
+  BenchImages(bench);
+  BenchSimulatedCamera(bench);
+  BenchSettings(bench);
+  if (var_map.count("serial")) {
+    try {
+      BenchProperties(bench, var_map["serial"].as<std::string>());
+    } catch (const std::exception& e) {
+      std::cerr << "*** Error: " << e.what() << std::endl;
+      return 1;
+    }
+  }
+
+  if (format == "csv") {
+    PrintCsv(bench.results());
+  } else {
+    PrintJson(bench.results(), min_time_s);
+  }
+  return 0;
+}
@@ -1,14 +1,26 @@
 #include "bluefox2/bluefox2.h"
+#include "bluefox2/device_registry.h"
 #include <sensor_msgs/fill_image.h>
 
+#include <chrono>
+#include <cmath>
+
 namespace bluefox2 {
 
 using namespace mvIMPACT::acquire;
 
+/**
+ * @brief MaxExposeUsAtFps Longest exposure at which the sensor keeps fps
+ */
+static int MaxExposeUsAtFps(const Bluefox2DynConfig &config) {
+  const double readout_fps =
+      PixelClockToFrameRate(config.cpc, config.width, config.height, 0);
+  return static_cast<int>(1e6 / config.fps - 1e6 / readout_fps);
+}
+
 Bluefox2::Bluefox2(const std::string &serial) : serial_(serial) {
-  if (!(dev_ = dev_mgr_.getDeviceBySerial(serial))) {
-    throw std::runtime_error(serial + " not found. " + AvailableDevice());
-  }
+  // Devices come from the registry, which may have opened them already
+  dev_ = DeviceRegistry::Instance().Open(serial);
   OpenDevice();
 }
 
@@ -18,43 +30,32 @@ Bluefox2::~Bluefox2() {
   }
 }
 
-std::string Bluefox2::AvailableDevice() const {
-  const auto dev_cnt = dev_mgr_.deviceCount();
-  std::string devices = std::to_string(dev_cnt) + " availabe device(s): ";
-  for (decltype(dev_mgr_.deviceCount()) i = 0; i < dev_cnt; ++i) {
-    devices += dev_mgr_.getDevice(i)->serial.read() + " ";
-  }
-  return devices;
-}
-
 void Bluefox2::OpenDevice() {
-  try {
-    dev_->open();
-  } catch (const ImpactAcquireException &e) {
-    throw std::runtime_error(e.what());
+  if (!dev_->isOpen()) {
+    try {
+      dev_->open();
+    } catch (const ImpactAcquireException &e) {
+      throw std::runtime_error(e.what());
+    }
   }
 
   // These poniters will probably leak, but we don't really care
   fi_ = new FunctionInterface(dev_);
-  //  stats_ = new Statistics(dev_);
+  stats_ = new Statistics(dev_);
   bf_set_ = new SettingsBlueFOX(dev_);
   cam_set_ = new CameraSettingsBlueFOX(dev_);
   sys_set_ = new SystemSettings(dev_);
   bf_info_ = new InfoBlueDevice(dev_);
   img_proc_ = new ImageProcessing(dev_);
-}
-
-int Bluefox2::GetExposeUs() const {
-  if (request_ && request_->isOK()) {
-    return request_->infoExposeTime_us.read();
-  } else {
-    return 0;
-  }
+  irc_ = new ImageRequestControl(dev_);
+  io_ = new IOSubSystemBlueFOX(dev_);
 }
 
 void Bluefox2::RequestSingle() const {
   int result = DMR_NO_ERROR;
-  result = fi_->imageRequestSingle();
+  const auto start = LatencyClock::now();
+  result = QueueRequest();
+  latency_.Record(LatencyStage::kRequest, start);
   if (result != DMR_NO_ERROR) {
     std::cout << serial() << ": Error while requesting image: "
               << ImpactAcquireException::getErrorCodeAsString(result)
@@ -62,15 +63,8 @@ void Bluefox2::RequestSingle() const {
   }
 }
 
-void Bluefox2::RequestImages(int n) const {
-  for (int i = 0; i < n; ++i) {
-    fi_->imageRequestSingle();
-    int requestNr = fi_->imageRequestWaitFor(timeout_ms_);
-    fi_->imageRequestUnlock(requestNr);
-  }
-}
-
-bool Bluefox2::GrabImage(sensor_msgs::Image &image_msg) {
+bool Bluefox2::GrabImage(sensor_msgs::Image &image_msg,
+                         FrameMetadata *metadata) {
   // NOTE: A request object is locked for the driver whenever the corresponding
   // wait function returns a valid request object.
   // All requests returned by
@@ -80,89 +74,483 @@ bool Bluefox2::GrabImage(sensor_msgs::Image &image_msg) {
   // http://www.matrix-vision.com/manuals/SDK_CPP/ImageAcquisition_section_capture.html
 
   int request_nr = INVALID_ID;
+  auto time = LatencyClock::now();
   request_nr = fi_->imageRequestWaitFor(timeout_ms_);
 
   // Check if request is valid
   if (!fi_->isRequestNrValid(request_nr)) {
     // We do not need to unlock here because the request is not valid?
     fi_->imageRequestUnlock(request_nr);
+    ++wait_timeouts_;
     return false;
   }
 
+  const auto arrival = ros::Time::now();
+  time = latency_.Record(LatencyStage::kWait, time);
   request_ = fi_->getRequest(request_nr);
 
+  // The driver numbers every request it processes, whatever the result
+  const int64_t frame_nr = request_->infoFrameNr.read();
+  if (frame_nr < frame_nr_) {
+    // Only goes back when the driver has been reopened
+    clock_sync_.Reset();
+  } else if (frame_nr_ >= 0) {
+    frame_nr_gaps_ += frame_nr - frame_nr_ - 1;
+  }
+  frame_nr_ = frame_nr;
+
   // Check if request is ok
   if (!request_->isOK()) {
     // need to unlock here because the request is valid even if it is not ok
     fi_->imageRequestUnlock(request_nr);
+    ++failed_requests_;
+    if (streaming_) RequestSingle();
     return false;
   }
 
-  std::string encoding;
+  ReadFrameMetadata();
+  if (metadata) *metadata = metadata_;
+  if (calibrating()) StepCalibration();
+  if (expose_pending_) CheckExpose();
+
+  // Format is read from the first request after the settings have changed
+  if (!format_.valid()) ReadFrameFormat();
+  time = latency_.Record(LatencyStage::kFrameInfo, time);
+
+  if (hw_stamp_) StampImage(image_msg, arrival);
+
+  const auto request_data = request_->imageData.read();
+  if (user_buffer_) {
+    const auto n = request_->getNumber();
+    if (n < static_cast<int>(buffers_.size()) &&
+        request_data == buffers_[n].data()) {
+      // The driver captured straight into our buffer, so instead of copying
+      // we swap it into the message and hand the message's previous storage
+      // back to the request
+      image_msg.encoding = *format_.encoding;
+      image_msg.height = format_.height;
+      image_msg.width = format_.width;
+      image_msg.step = format_.step;
+      image_msg.is_bigendian = 0;
+      fi_->imageRequestUnlock(request_nr);
+
+      std::swap(image_msg.data, buffers_[n]);
+      image_msg.data.resize(image_msg.step * image_msg.height);
+      AttachUserBuffer(n);
+      latency_.Record(LatencyStage::kCopy, time);
+      if (streaming_) RequestSingle();
+      return true;
+    }
+  }
+
+  sensor_msgs::fillImage(image_msg, *format_.encoding, format_.height,
+                         format_.width, format_.step, request_data);
+
+  // Release capture request
+  fi_->imageRequestUnlock(request_nr);
+  latency_.Record(LatencyStage::kCopy, time);
+  if (streaming_) RequestSingle();
+  return true;
+}
+
+void Bluefox2::ReadFrameFormat() {
   const auto bayer_mosaic_parity = request_->imageBayerMosaicParity.read();
   if (bayer_mosaic_parity != bmpUndefined) {
     // Bayer pattern
     const auto bytes_per_pixel = request_->imageBytesPerPixel.read();
-    encoding = BayerPatternToEncoding(bayer_mosaic_parity, bytes_per_pixel);
+    format_.encoding =
+        &BayerPatternToEncoding(bayer_mosaic_parity, bytes_per_pixel);
   } else {
-    encoding = PixelFormatToEncoding(request_->imagePixelFormat.read());
+    format_.encoding =
+        &PixelFormatToEncoding(request_->imagePixelFormat.read());
   }
-  sensor_msgs::fillImage(image_msg, encoding, request_->imageHeight.read(),
-                         request_->imageWidth.read(),
-                         request_->imageLinePitch.read(),
-                         request_->imageData.read());
+  format_.width = request_->imageWidth.read();
+  format_.height = request_->imageHeight.read();
+  format_.step = request_->imageLinePitch.read();
+}
 
-  // Release capture request
-  fi_->imageRequestUnlock(request_nr);
-  return true;
+void Bluefox2::ReadFrameMetadata() {
+  metadata_.frame_nr = frame_nr_;
+  metadata_.expose_us = request_->infoExposeTime_us.read();
+  metadata_.gain_db = request_->infoGain_dB.read();
+  metadata_.transfer_delay_us = request_->infoTransferDelay_us.read();
+
+  // infoTimeStamp_us is 64 bit, infoExposeStart_us is 32 bit on the same
+  // clock and 0 when unknown, in which case the time stamp marks the start
+  const int64_t time_stamp_us = request_->infoTimeStamp_us.read();
+  const auto expose_start_us =
+      static_cast<uint32_t>(request_->infoExposeStart_us.read());
+  metadata_.expose_start_us = time_stamp_us;
+  if (expose_start_us) {
+    const uint32_t delta_us =
+        static_cast<uint32_t>(time_stamp_us) - expose_start_us;
+    if (delta_us < 1000000) metadata_.expose_start_us -= delta_us;
+  }
+
+  const auto &io_start = request_->infoIOStatesAtExposureStart;
+  const auto &io_end = request_->infoIOStatesAtExposureEnd;
+  metadata_.io_states_start = io_start.isValid() ? io_start.read() : 0;
+  metadata_.io_states_end = io_end.isValid() ? io_end.read() : 0;
+
+  metadata_.bracket = -1;
+  if (bracket_count_ > 1) {
+    const int setting = request_->infoSettingUsed.read();
+    const auto end = bracket_settings_.cbegin() + bracket_count_;
+    const auto it = std::find(bracket_settings_.cbegin(), end, setting);
+    if (it != end) metadata_.bracket = it - bracket_settings_.cbegin();
+  }
+}
+
+void Bluefox2::StampImage(sensor_msgs::Image &image_msg,
+                          const ros::Time &arrival) {
+  const auto start_us = metadata_.expose_start_us;
+  const auto expose_us = metadata_.expose_us;
+  // The frame can only arrive after the end of its exposure
+  clock_sync_.Update(start_us + expose_us, arrival.toSec());
+  image_msg.header.stamp.fromSec(clock_sync_.ToHost(start_us + expose_us / 2));
+}
+
+void Bluefox2::StartStreaming() {
+  // Top up the queue, requests left over from the last stream are still in it
+  const auto request_cnt = fi_->requestCount();
+  for (decltype(fi_->requestCount()) i = 0; i < request_cnt; ++i) {
+    if (QueueRequest() != DMR_NO_ERROR) break;
+  }
+  streaming_ = true;
+}
+
+// Not every driver supports every statistic, so skip the invalid ones quietly
+template <typename PropertyType, typename ValueType>
+void ReadIfValid(const PropertyType &prop, ValueType &value) {
+  if (prop.isValid()) value = prop.read();
+}
+
+Bluefox2Stats Bluefox2::GetStats() const {
+  Bluefox2Stats stats;
+  ReadIfValid(stats_->framesPerSecond, stats.frames_per_second);
+  ReadIfValid(stats_->captureTime_s, stats.capture_time_s);
+  ReadIfValid(stats_->bandwidthConsumed, stats.bandwidth_kbps);
+  ReadIfValid(stats_->frameCount, stats.frame_count);
+  ReadIfValid(stats_->errorCount, stats.error_count);
+  ReadIfValid(stats_->timedOutRequestsCount, stats.timed_out_count);
+  ReadIfValid(stats_->abortedRequestsCount, stats.aborted_count);
+  ReadIfValid(stats_->lostImagesCount, stats.lost_images_count);
+  ReadIfValid(stats_->framesIncompleteCount, stats.incomplete_count);
+
+  stats.wait_timeouts = wait_timeouts_;
+  stats.failed_requests = failed_requests_;
+  stats.frame_nr_gaps = frame_nr_gaps_;
+  stats.user_buffer_fallbacks = user_buffer_fallbacks_;
+  return stats;
+}
+
+void Bluefox2::SetRequestCount(int &request_count) const {
+  WriteAndReadProperty(sys_set_->requestCount, request_count);
+}
+
+int64_t Bluefox2::SetExpose(int &expose_us, double &gain_db, bool set_gain,
+                            int timeout_ms) {
+  bool auto_expose = false;
+  ReadProperty(cam_set_->autoExposeControl, auto_expose);
+  // Bracketed exposures are derived from expose_us by Configure
+  if (auto_expose || bracket_count_ > 1) return -1;
+
+  std::unique_lock<std::mutex> lock(expose_mutex_);
+  // Properties apply to every request sent to the camera after the write
+  WriteAndReadProperty(cam_set_->expose_us, expose_us);
+  if (set_gain) {
+    WriteAndReadProperty(cam_set_->gain_dB, gain_db);
+  } else {
+    ReadProperty(cam_set_->gain_dB, gain_db);
+  }
+  expose_target_us_ = expose_us;
+  gain_target_db_ = gain_db;
+  gain_target_set_ = set_gain;
+  expose_frame_nr_ = -1;
+  expose_pending_ = true;
+
+  expose_cond_.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                        [this] { return !expose_pending_; });
+  expose_pending_ = false;
+  return expose_frame_nr_;
+}
+
+void Bluefox2::CheckExpose() {
+  // Gain is a double that the driver rounds to its own step
+  static const double kGainToleranceDb = 0.01;
+  std::lock_guard<std::mutex> lock(expose_mutex_);
+  if (!expose_pending_) return;
+  if (metadata_.expose_us != expose_target_us_) return;
+  if (gain_target_set_ &&
+      std::abs(metadata_.gain_db - gain_target_db_) > kGainToleranceDb) {
+    return;
+  }
+  expose_frame_nr_ = metadata_.frame_nr;
+  expose_pending_ = false;
+  expose_cond_.notify_all();
+}
+
+void Bluefox2::set_calibration_cache(const std::string &path) {
+  if (path.empty()) {
+    calib_cache_.reset();
+  } else {
+    calib_cache_.reset(new CalibrationCache(path));
+  }
+}
+
+void Bluefox2::StepCalibration() {
+  // White balance was calibrated on this frame
+  if (wb_pending_) {
+    wb_pending_ = false;
+    const auto wbp_set = img_proc_->getWBUserSetting(0);
+    WhiteBalanceGains gains;
+    ReadProperty(wbp_set.redGain, gains.r_gain);
+    ReadProperty(wbp_set.greenGain, gains.g_gain);
+    ReadProperty(wbp_set.blueGain, gains.b_gain);
+    config_.r_gain = gains.r_gain;
+    config_.g_gain = gains.g_gain;
+    config_.b_gain = gains.b_gain;
+    if (calib_cache_ && !calib_cache_->Store(calib_key_, gains)) {
+      std::cout << serial() << ": failed to write " << calib_cache_->path()
+                << std::endl;
+    }
+  }
+
+  // Dark current filter has seen all the frames it averages
+  if (dark_current_frames_ > 0 && --dark_current_frames_ == 0) {
+    WriteProperty(img_proc_->darkCurrentFilterMode, dcfmOn);
+    WriteProperty(cam_set_->offsetAutoCalibration, aocOn);
+  }
 }
 
 void Bluefox2::Configure(Bluefox2DynConfig &config) {
-  // Clear request queue
-  fi_->imageRequestReset(0, 0);
+  // Only write the properties that differ from the cached config, everything
+  // is written on the first call
+  const bool init = !configured_;
+  const auto &prev = config_;
+
+  // Pixel clock and frame rate go first, the exposure cap depends on them
+  PlanFrameRate(config);
+
+  const bool idpf = init || config.idpf != prev.idpf;
+  const bool cbm = init || config.cbm != prev.cbm;
+  // Binning changes the size of the sensor seen by the AOI
+  const bool aoi = cbm || config.width != prev.width ||
+                   config.height != prev.height ||
+                   config.offset_x != prev.offset_x ||
+                   config.offset_y != prev.offset_y;
+  const bool hdr = init || config.hdr != prev.hdr;
+  const bool bracket = init || config.bracket_count != prev.bracket_count ||
+                       config.bracket_ev != prev.bracket_ev;
+  const bool cpc = init || config.cpc != prev.cpc;
+  const bool ctm = init || config.ctm != prev.ctm;
+  // Hardware timing takes over the trigger source
+  const bool cts = init || ctm || config.cts != prev.cts;
+  const bool hardware_timed = config.ctm == Bluefox2Dyn_ctm_hardware_timed;
+  const bool rtc = ctm || (hardware_timed && (config.fps != prev.fps ||
+                                              config.rtc_digout !=
+                                                  prev.rtc_digout));
+  const bool agc = init || config.agc != prev.agc ||
+                   (!config.agc && config.gain_db != prev.gain_db);
+  const bool aec = init || config.aec != prev.aec ||
+                   (!config.aec && config.expose_us != prev.expose_us);
+  // The exposure cap follows the frame time
+  const bool acs = agc || aec || aoi || cpc || config.acs != prev.acs ||
+                   config.des_grey_value != prev.des_grey_value ||
+                   config.ac_aoi != prev.ac_aoi ||
+                   config.ac_aoi_x != prev.ac_aoi_x ||
+                   config.ac_aoi_y != prev.ac_aoi_y ||
+                   config.ac_aoi_width != prev.ac_aoi_width ||
+                   config.ac_aoi_height != prev.ac_aoi_height ||
+                   config.ac_expose_min_us != prev.ac_expose_min_us ||
+                   config.ac_expose_max_us != prev.ac_expose_max_us ||
+                   config.ac_gain_min_db != prev.ac_gain_min_db ||
+                   config.ac_gain_max_db != prev.ac_gain_max_db ||
+                   config.fps != prev.fps;
+  const bool wbp = init || config.wbp != prev.wbp ||
+                   config.r_gain != prev.r_gain ||
+                   config.g_gain != prev.g_gain || config.b_gain != prev.b_gain;
+  const bool dcfm = init || config.dcfm != prev.dcfm;
+  // Calibration has to see images taken after it was switched on
+  const bool calibrate = (dcfm && config.dcfm == dcfmCalibrateDarkCurrent) ||
+                         (wbp && config.wbp == Bluefox2Dyn_wbp_calibrate);
+
+  // Requests in the queue are only invalid when the image format or the way
+  // the sensor is triggered changes, exposure and gain apply to the next frame.
+  // A new request count refills the queue from empty, so it does not add up
+  // with the requests in flight
+  const bool request = config.request != prev.request;
+  const bool flush = aoi || idpf || cbm || hdr || cpc || ctm || cts ||
+                     calibrate || request;
+  if (flush) {
+    // Clear request queue
+    fi_->imageRequestReset(0, 0);
+    // Read the image format again from the first new request
+    format_.Invalidate();
+    // Settings below may change the buffer layout, so let the driver allocate
+    // memory until they are all applied
+    DetachUserBuffers();
+  }
 
-  // Area of Intreset
-  SetAoi(config.width, config.height);
   // Pixel Format
-  SetIdpf(config.idpf);
+  if (idpf) SetIdpf(config.idpf);
   // Binning
-  SetCbm(config.cbm);
+  if (cbm) SetCbm(config.cbm);
+  // Area of Intreset
+  if (aoi) {
+    SetAoi(config.offset_x, config.offset_y, config.width, config.height);
+  }
 
   // Gain
-  SetAgc(config.agc, config.gain_db);
+  if (agc) SetAgc(config.agc, config.gain_db);
   // Expose
-  SetAec(config.aec, config.expose_us);
+  if (aec) SetAec(config.aec, config.expose_us);
   // Auto Controller
-  SetAcs(config.acs, config.des_grey_value);
+  if (acs) {
+    SetAcs(config.acs, config.des_grey_value);
+    if (config.acs != Bluefox2Dyn_acs_unavailable) {
+      SetAcAoi(config.ac_aoi, config.ac_aoi_x, config.ac_aoi_y,
+               config.ac_aoi_width, config.ac_aoi_height);
+      SetAcLimits(config.ac_expose_min_us, config.ac_expose_max_us,
+                  config.ac_gain_min_db, config.ac_gain_max_db,
+                  MaxExposeUsAtFps(config));
+    }
+  }
+  // Exposure Bracketing, follows expose_us
+  if (bracket || aec) {
+    SetBracket(config.bracket_count, config.bracket_ev, config.aec,
+               config.expose_us);
+  }
 
-  // White Balance
-  SetWbp(config.wbp, config.r_gain, config.g_gain, config.b_gain);
+  // White Balance, calibrations are cached for the exposure they were made at
+  calib_key_.expose_us = config.expose_us;
+  calib_key_.gain_db = config.gain_db;
+  calib_key_.pixel_clock_khz = config.cpc;
+  if (wbp) SetWbp(config.wbp, config.r_gain, config.g_gain, config.b_gain);
   // High Dynamic Range
-  SetHdr(config.hdr);
+  if (hdr) SetHdr(config.hdr);
   // Dark Current Filter
-  SetDcfm(config.dcfm);
+  if (dcfm) SetDcfm(config.dcfm);
   // Pixel Clock
-  SetCpc(config.cpc);
+  if (cpc) SetCpc(config.cpc);
   // Trigger Mode
-  SetCtm(config.ctm);
+  if (ctm) SetCtm(config.ctm);
   // Trigger Source
-  SetCts(config.cts);
+  if (cts && !hardware_timed) SetCts(config.cts);
+  // Real Time Controller
+  if (rtc) SetRtc(hardware_timed ? config.fps : 0, config.rtc_digout);
+
+  if (flush) {
+    // User buffer
+    if (user_buffer_) AttachUserBuffers();
+  }
   // Request
-  FillCaptureQueue(config.request);
+  if (flush) FillCaptureQueue(config.request);
 
   // Cache this config
   config_ = config;
+  configured_ = true;
 }
 
 void Bluefox2::FillCaptureQueue(int &n) const {
   n = std::min<int>(n, fi_->requestCount() - 1);
   for (int i = 0; i < n; ++i) {
-    fi_->imageRequestSingle();
+    QueueRequest();
+  }
+}
+
+int Bluefox2::QueueRequest() const {
+  if (bracket_count_ > 1) {
+    // The setting is picked up when the request is queued
+    irc_->setting.write(bracket_settings_[bracket_next_]);
+    bracket_next_ = (bracket_next_ + 1) % bracket_count_;
+  }
+  return fi_->imageRequestSingle();
+}
+
+void Bluefox2::AttachUserBuffers() {
+  int alignment = 0;
+  const int result =
+      fi_->getCurrentCaptureBufferLayout(*irc_, buffer_size_, alignment);
+  if (result != DMR_NO_ERROR) {
+    std::cout << serial() << ": Error while querying buffer layout: "
+              << ImpactAcquireException::getErrorCodeAsString(result)
+              << std::endl;
+    return;
+  }
+  buffer_alignment_ = std::max(alignment, 1);
+
+  const auto request_cnt = fi_->requestCount();
+  buffers_.resize(request_cnt);
+  for (decltype(fi_->requestCount()) i = 0; i < request_cnt; ++i) {
+    AttachUserBuffer(i);
+  }
+}
+
+void Bluefox2::DetachUserBuffers() {
+  for (size_t i = 0; i < buffers_.size(); ++i) {
+    Request *request = fi_->getRequest(i);
+    if (request->imageMemoryMode.read() == rimmUser) {
+      request->detachUserBuffer();
+    }
+  }
+}
+
+bool Bluefox2::AttachUserBuffer(int request_nr) {
+  auto &buffer = buffers_[request_nr];
+  // Storage handed back by a recycled message already has the capacity, so
+  // this only fills the tail the message trimmed off
+  buffer.resize(buffer_size_);
+
+  Request *request = fi_->getRequest(request_nr);
+  // The storage is swapped into sensor_msgs::Image, whose data vector fixes
+  // the allocator, so the alignment cannot be chosen. Requests that end up
+  // with a misaligned buffer fall back to driver allocated memory and a copy
+  if (reinterpret_cast<std::uintptr_t>(buffer.data()) % buffer_alignment_) {
+    if (request->imageMemoryMode.read() == rimmUser) {
+      request->detachUserBuffer();
+    }
+    if (user_buffer_fallbacks_++ == 0) {
+      std::cout << serial() << ": User buffer is not aligned to "
+                << buffer_alignment_ << " bytes, copying its frames instead"
+                << std::endl;
+    }
+    return false;
+  }
+
+  const int result = request->attachUserBuffer(buffer.data(), buffer_size_);
+  if (result != DMR_NO_ERROR) {
+    std::cout << serial() << ": Error while attaching user buffer: "
+              << ImpactAcquireException::getErrorCodeAsString(result)
+              << std::endl;
+    return false;
   }
+  return true;
 }
 
-void Bluefox2::SetAoi(int &width, int &height) const {
-  // FIXEM: not implemented
+void Bluefox2::SetAoi(int &x, int &y, int &width, int &height) const {
+  // Move the AOI to the origin first, the valid range of width and height
+  // depends on the offsets and vice versa
+  WriteProperty(cam_set_->aoiStartX, 0);
+  WriteProperty(cam_set_->aoiStartY, 0);
+
+  // 0 selects the full sensor
+  if (width <= 0) width = cam_set_->aoiWidth.getMaxValue();
+  if (height <= 0) height = cam_set_->aoiHeight.getMaxValue();
+  width = RoundToStepWidth(cam_set_->aoiWidth,
+                           ClampProperty(cam_set_->aoiWidth, width));
+  height = RoundToStepWidth(cam_set_->aoiHeight,
+                            ClampProperty(cam_set_->aoiHeight, height));
+  WriteAndReadProperty(cam_set_->aoiWidth, width);
+  WriteAndReadProperty(cam_set_->aoiHeight, height);
+
+  // Offsets are limited to what is left of the sensor
+  x = RoundToStepWidth(cam_set_->aoiStartX,
+                       ClampProperty(cam_set_->aoiStartX, x));
+  y = RoundToStepWidth(cam_set_->aoiStartY,
+                       ClampProperty(cam_set_->aoiStartY, y));
+  WriteAndReadProperty(cam_set_->aoiStartX, x);
+  WriteAndReadProperty(cam_set_->aoiStartY, y);
 }
 
 void Bluefox2::SetIdpf(int &idpf) const {
@@ -187,7 +575,6 @@ void Bluefox2::SetAec(bool &auto_expose, int &expose_us) const {
   }
 }
 
-// TODO: consider adding auto control limit here
 void Bluefox2::SetAcs(int &acs, int &des_gray_val) const {
   if (cam_set_->autoControlParameters.isAvailable()) {
     bool agc = false, aec = false;
@@ -206,8 +593,50 @@ void Bluefox2::SetAcs(int &acs, int &des_gray_val) const {
   acs = Bluefox2Dyn_acs_unavailable;
 }
 
+void Bluefox2::SetAcAoi(int &mode, int &x, int &y, int &width,
+                        int &height) const {
+  const auto &acp = cam_set_->autoControlParameters;
+  WriteAndReadProperty(acp.aoiMode, mode);
+  if (mode != amUseAoi) return;
+
+  // Same order as SetAoi, the valid ranges depend on each other
+  WriteProperty(acp.aoiStartX, 0);
+  WriteProperty(acp.aoiStartY, 0);
+  if (width <= 0) width = acp.aoiWidth.getMaxValue();
+  if (height <= 0) height = acp.aoiHeight.getMaxValue();
+  WriteAndReadProperty(acp.aoiWidth, width);
+  WriteAndReadProperty(acp.aoiHeight, height);
+  WriteAndReadProperty(acp.aoiStartX, x);
+  WriteAndReadProperty(acp.aoiStartY, y);
+}
+
+void Bluefox2::SetAcLimits(int &expose_min_us, int &expose_max_us,
+                           double &gain_min_db, double &gain_max_db,
+                           int fps_expose_max_us) const {
+  const auto &acp = cam_set_->autoControlParameters;
+  // 0 leaves the cap to the frame rate
+  int expose_cap_us = fps_expose_max_us;
+  if (expose_max_us > 0) expose_cap_us = std::min(expose_cap_us, expose_max_us);
+  expose_cap_us = std::max(expose_cap_us, expose_min_us);
+  gain_min_db = std::min(gain_min_db, gain_max_db);
+
+  // Each limit is checked against the other one, writing the upper limit
+  // again after the lower one works whichever way they move
+  WriteProperty(acp.exposeUpperLimit_us, expose_cap_us);
+  WriteAndReadProperty(acp.exposeLowerLimit_us, expose_min_us);
+  WriteAndReadProperty(acp.exposeUpperLimit_us, expose_cap_us);
+  WriteProperty(acp.gainUpperLimit_dB, gain_max_db);
+  WriteAndReadProperty(acp.gainLowerLimit_dB, gain_min_db);
+  WriteAndReadProperty(acp.gainUpperLimit_dB, gain_max_db);
+  if (expose_max_us > 0 && expose_max_us != expose_cap_us) {
+    std::cout << serial() << ": ac_expose_max_us " << expose_max_us
+              << " limited to " << expose_cap_us << " us" << std::endl;
+    expose_max_us = expose_cap_us;
+  }
+}
+
 void Bluefox2::SetWbp(int &wbp, double &r_gain, double &g_gain,
-                      double &b_gain) const {
+                      double &b_gain) {
   // Put white balance as unavailable if it's not a color camera
   if (bf_info_->sensorColorMode.read() <= iscmMono) {
     wbp = Bluefox2Dyn_wbp_unavailable;
@@ -237,12 +666,20 @@ void Bluefox2::SetWbp(int &wbp, double &r_gain, double &g_gain,
   if (wbp == Bluefox2Dyn_wbp_calibrate) {
     // Set wbp to user1
     WriteProperty(img_proc_->whiteBalance, wbpUser1);
-    // Calibrate next frame
-    WriteProperty(img_proc_->whiteBalanceCalibration, wbcmNextFrame);
-    // Request one image?
-    RequestImages(1);
+    auto wbp_set = img_proc_->getWBUserSetting(0);
+    WhiteBalanceGains gains;
+    if (calib_cache_ && calib_cache_->Find(calib_key_, gains)) {
+      // Calibrated before at the same settings
+      WriteProperty(wbp_set.redGain, gains.r_gain);
+      WriteProperty(wbp_set.greenGain, gains.g_gain);
+      WriteProperty(wbp_set.blueGain, gains.b_gain);
+    } else {
+      // Calibrate on the next frame of the stream, the gains are read back
+      // and cached once it has arrived
+      WriteProperty(img_proc_->whiteBalanceCalibration, wbcmNextFrame);
+      wb_pending_ = true;
+    }
     // Set config to user1 and update gains
-    const auto wbp_set = img_proc_->getWBUserSetting(0);
     ReadProperty(wbp_set.redGain, r_gain);
     ReadProperty(wbp_set.greenGain, g_gain);
     ReadProperty(wbp_set.blueGain, b_gain);
@@ -264,7 +701,51 @@ void Bluefox2::SetHdr(bool &hdr) const {
   }
 }
 
-void Bluefox2::SetDcfm(int &dcfm) const {
+void Bluefox2::SetBracket(int &count, double ev, bool auto_expose,
+                          int expose_us) {
+  // Bracketing needs fixed exposures
+  if (auto_expose) count = 1;
+  if (count > 1 && bracket_settings_.empty()) {
+    base_setting_ = irc_->setting.read();
+  }
+
+  // Settings are created once and derive everything but the exposure from
+  // the base setting, so later changes of the base apply to them as well
+  while (count > static_cast<int>(bracket_settings_.size())) {
+    const auto name = "Bracket" + std::to_string(bracket_settings_.size());
+    ComponentList setting;
+    const int result = fi_->createSetting(name, "Base", &setting);
+    if (result != DMR_NO_ERROR) {
+      std::cout << serial() << ": Error while creating setting " << name
+                << ": " << ImpactAcquireException::getErrorCodeAsString(result)
+                << std::endl;
+      count = std::max<int>(bracket_settings_.size(), 1);
+      break;
+    }
+    bracket_settings_.push_back(setting.hObj());
+  }
+  if (count == 1) {
+    if (bracket_count_ > 1) irc_->setting.write(base_setting_);
+    bracket_count_ = 1;
+    return;
+  }
+
+  // Exposures are spread evenly in stops around expose_us
+  const double center = (count - 1) / 2.0;
+  for (int i = 0; i < count; ++i) {
+    CameraSettingsBlueFOX cam_set(dev_, "Bracket" + std::to_string(i));
+    int bracket_expose_us = static_cast<int>(
+        expose_us * std::pow(2.0, ev * (i - center)) + 0.5);
+    bracket_expose_us = ClampProperty(cam_set.expose_us, bracket_expose_us);
+    WriteProperty(cam_set.autoExposeControl, false);
+    WriteAndReadProperty(cam_set.expose_us, bracket_expose_us);
+  }
+  bracket_count_ = count;
+  bracket_next_ = 0;
+}
+
+void Bluefox2::SetDcfm(int &dcfm) {
+  dark_current_frames_ = 0;
   if (dcfm == dcfmCalibrateDarkCurrent) {
     // Special case for calibrate mode
     // Set "OffsetAutoCalibration = Off"
@@ -272,13 +753,12 @@ void Bluefox2::SetDcfm(int &dcfm) const {
     // TODO: turn off auto control here?
     // Set filter mode = calibrate
     WriteProperty(img_proc_->darkCurrentFilterMode, dcfmCalibrateDarkCurrent);
-    // Read image count, and request some more images
-    int img_cnt = img_proc_->darkCurrentFilterCalibrationImageCount.read();
-    RequestImages(img_cnt);
-    // Then turn on immediately
-    WriteProperty(img_proc_->darkCurrentFilterMode, dcfmOn);
-    WriteProperty(cam_set_->offsetAutoCalibration, aocOn);
-    ReadProperty(img_proc_->darkCurrentFilterMode, dcfm);
+    // The filter averages the next frames of the stream and is turned on
+    // once it has seen all of them
+    dark_current_frames_ =
+        img_proc_->darkCurrentFilterCalibrationImageCount.read();
+    // Report the mode it will end up in
+    dcfm = dcfmOn;
   } else {
     WriteAndReadProperty(img_proc_->darkCurrentFilterMode, dcfm);
   }
@@ -288,12 +768,111 @@ void Bluefox2::SetCpc(int &cpc) const {
   WriteAndReadProperty(cam_set_->pixelClock_KHz, cpc);
 }
 
+std::vector<int> Bluefox2::pixel_clocks() const {
+  std::vector<int> pclks_khz;
+  for (const auto &entry : GetTranslationDict(cam_set_->pixelClock_KHz)) {
+    pclks_khz.push_back(static_cast<int>(entry.second));
+  }
+  return pclks_khz;
+}
+
+void Bluefox2::PlanFrameRate(Bluefox2DynConfig &config) const {
+  // The AOI is resolved later, an unset size means the full sensor
+  const int width = config.width > 0 ? config.width
+                                     : cam_set_->aoiWidth.getMaxValue();
+  const int height = config.height > 0 ? config.height
+                                       : cam_set_->aoiHeight.getMaxValue();
+  // Plan for the longest exposure a frame is expected to take
+  double expose_us = config.expose_us;
+  if (config.aec && config.ac_expose_max_us > 0) {
+    expose_us = config.ac_expose_max_us;
+  }
+  if (config.bracket_count > 1) {
+    expose_us *= std::pow(2.0, config.bracket_ev *
+                                   (config.bracket_count - 1) / 2.0);
+  }
+
+  if (config.cpc_auto) {
+    const auto pclks_khz = pixel_clocks();
+    if (!pclks_khz.empty()) {
+      config.cpc =
+          PlanPixelClock(pclks_khz, config.fps, width, height, expose_us);
+    }
+  }
+
+  // Report the frame rate the sensor can reach instead of silently dropping
+  // frames, hdr mode reads out faster than this model assumes
+  if (config.hdr) return;
+  const double max_fps =
+      PixelClockToFrameRate(config.cpc, width, height, expose_us);
+  if (config.fps > max_fps) {
+    std::cout << serial() << ": fps " << config.fps << " limited to "
+              << max_fps << " at " << config.cpc << " KHz" << std::endl;
+    config.fps = max_fps;
+  }
+}
+
 void Bluefox2::SetCtm(int &ctm) const {
   // Do nothing when set to hard sync
   if (ctm == Bluefox2Dyn_hard_sync) return;
+  if (ctm == Bluefox2Dyn_ctm_hardware_timed) {
+    if (io_->RTCtrProgramCount() == 0) {
+      std::cout << serial() << ": no real time controller" << std::endl;
+      ctm = ctmOnDemand;
+    } else {
+      // The real time controller raises the trigger signal at fps
+      WriteProperty(cam_set_->triggerSource, ctsRTCtrl);
+      WriteProperty(cam_set_->triggerMode, ctmOnRisingEdge);
+      return;
+    }
+  }
   WriteAndReadProperty(cam_set_->triggerMode, ctm);
 }
 
+void Bluefox2::SetRtc(double fps, int digout) const {
+  // Trigger signal has to stay high for at least 100 us
+  static const int kTriggerHighUs = 100;
+  if (io_->RTCtrProgramCount() == 0) return;
+  auto &program = *io_->getRTCtrProgram(0);
+  program.mode.write(rtctrlModeStop);
+  if (fps <= 0) return;
+
+  // Outputs that are pulsed together with the trigger, taken from the IO
+  // subsystem because a fresh program has no steps to ask yet
+  const auto output_cnt = static_cast<int>(io_->getOutputCount());
+  const bool pulse = (digout & ((1 << output_cnt) - 1)) != 0;
+  const auto write_outputs = [&](RTCtrProgramStep *step, bool on) {
+    step->opCode.write(rtctrlProgSetDigout);
+    for (int i = 0; i < output_cnt; ++i) {
+      const bool selected = digout & (1 << i);
+      step->digitalOutputs.write(
+          selected ? (on ? digioOn : digioOff) : digioKeep, i);
+    }
+  };
+
+  const int period_us = static_cast<int>(1e6 / fps + 0.5);
+  program.setProgramSize(pulse ? 7 : 5);
+  int n = 0;
+  RTCtrProgramStep *step = program.programStep(n++);
+  step->opCode.write(rtctrlProgWaitClocks);
+  step->clocks_us.write(std::max(period_us - kTriggerHighUs, kTriggerHighUs));
+  step = program.programStep(n++);
+  step->opCode.write(rtctrlProgTriggerSet);
+  if (pulse) write_outputs(program.programStep(n++), true);
+  step = program.programStep(n++);
+  step->opCode.write(rtctrlProgWaitClocks);
+  step->clocks_us.write(kTriggerHighUs);
+  step = program.programStep(n++);
+  step->opCode.write(rtctrlProgTriggerReset);
+  if (pulse) write_outputs(program.programStep(n++), false);
+  step = program.programStep(n++);
+  step->opCode.write(rtctrlProgJumpLoc);
+  step->address.write(0);
+  program.mode.write(rtctrlModeRun);
+  std::cout << serial() << ": hardware timed at " << 1e6 / period_us
+            << " fps" << std::endl;
+}
+
 void Bluefox2::SetCts(int &cts) const {
   // Do nothing when trigger source is not visible
   if (!cam_set_->triggerSource.isVisible()) {
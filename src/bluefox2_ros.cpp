@@ -1,11 +1,57 @@
 #include "bluefox2/bluefox2_ros.h"
+#include "bluefox2/device_registry.h"
+#include "bluefox2/simulated_camera.h"
+
+#include <sys/stat.h>
+#include <algorithm>
+#include <cstdlib>
 
 namespace bluefox2 {
 
+// Messages recycled when user_buffer is set without a pool_size
+static const size_t kUserBufferPoolSize = 8;
+
+/**
+ * @brief DefaultCalibrationCache Cache file of a camera under ROS_HOME
+ */
+static std::string DefaultCalibrationCache(const std::string& serial) {
+  std::string dir;
+  if (const char* ros_home = std::getenv("ROS_HOME")) {
+    dir = ros_home;
+  } else if (const char* home = std::getenv("HOME")) {
+    dir = std::string(home) + "/.ros";
+  } else {
+    return std::string();
+  }
+  dir += "/bluefox2";
+  // Fails harmlessly when it already exists
+  mkdir(dir.c_str(), 0755);
+  return dir + "/" + serial + ".calib";
+}
+
+/**
+ * @brief MakeCameraBackend Camera selected by the backend param
+ * "sim" simulates the camera, anything else opens the real one
+ */
+static std::unique_ptr<CameraBackend> MakeCameraBackend(
+    const ros::NodeHandle& cnh, const std::string& serial) {
+  std::string backend;
+  cnh.param<std::string>("backend", backend, "mvimpact");
+  if (backend == "sim") {
+    double latency_ms;
+    cnh.param<double>("sim_latency_ms", latency_ms, 5.0);
+    std::string replay;
+    cnh.param<std::string>("sim_replay", replay, "");
+    return std::unique_ptr<CameraBackend>(
+        new SimulatedCamera(serial, latency_ms, replay));
+  }
+  return std::unique_ptr<CameraBackend>(new Bluefox2(serial));
+}
+
 Bluefox2Ros::Bluefox2Ros(const ros::NodeHandle& nh, const std::string& prefix)
-    : CameraRosBase(nh, prefix), bluefox2_(identifier()) {
-  //  bluefox2_.OpenDevice();
-  SetHardwareId(bluefox2_.serial());
+    : CameraRosBase(nh, prefix),
+      camera_(MakeCameraBackend(ros::NodeHandle(nh, prefix), identifier())) {
+  SetHardwareId(camera_->serial());
 
   // Some hack for getting hardware sync to work
   ros::NodeHandle cnh(nh, prefix);
@@ -13,21 +59,343 @@ Bluefox2Ros::Bluefox2Ros(const ros::NodeHandle& nh, const std::string& prefix)
   cnh.param<std::string>("mode", mode, "");
 
   if (mode == "master") {
-    bluefox2_.SetMaster();
+    camera_->SetMaster();
   } else if (mode == "slave") {
-    bluefox2_.SetSlave();
+    camera_->SetSlave();
   }
 
   // Set mirror mode on construction
   int mm;
   cnh.param<int>("mm", mm, 0);
-  bluefox2_.SetMM(mm);
+  camera_->SetMM(mm);
+
+  // Capture directly into image messages instead of copying each frame
+  bool user_buffer;
+  cnh.param<bool>("user_buffer", user_buffer, false);
+  camera_->set_user_buffer(user_buffer);
+
+  // Stamp images from the camera clock instead of the time of request
+  bool hw_stamp;
+  cnh.param<bool>("hw_stamp", hw_stamp, false);
+  camera_->set_hw_stamp(hw_stamp);
+
+  // Number of requests the driver allocates, 0 keeps the driver default
+  int request_count;
+  cnh.param<int>("request_count", request_count, 0);
+  if (request_count > 0) {
+    camera_->SetRequestCount(request_count);
+  }
+
+  // Reuse white balance calibrations across restarts
+  std::string calib_cache;
+  cnh.param<std::string>("calib_cache", calib_cache,
+                         DefaultCalibrationCache(camera_->serial()));
+  camera_->set_calibration_cache(calib_cache);
+
+  // Recycle published images once every subscriber has released them
+  int pool_size;
+  cnh.param<int>("pool_size", pool_size, 0);
+  pool_size_ = std::max(pool_size, 0);
+  // Storage swapped out to the driver only comes back through recycled
+  // messages, without them every frame would allocate and zero a new buffer
+  if (user_buffer && pool_size_ == 0) {
+    pool_size_ = kUserBufferPoolSize;
+  }
+
+  // Exact per frame values next to the images
+  metadata_pub_ = cnh.advertise<Metadata>("metadata", 1);
+
+  // One image per exposure bracket with the best exposed parts of each frame
+  cnh.param<bool>("fuse_brackets", fuse_brackets_, false);
+  if (fuse_brackets_) {
+    image_transport::ImageTransport it(cnh);
+    fused_pub_ = it.advertise("image_hdr", 1);
+  }
+
+  // Pause acquisition while nobody listens. CameraRosBase keeps its publisher
+  // to itself, a second one on the same topics sees the same subscribers
+  cnh.param<bool>("lazy", lazy_, false);
+  if (lazy_) {
+    image_transport::ImageTransport it(cnh);
+    image_pub_ = it.advertiseCamera("image_raw", 1);
+  }
+
+  // Exposure changes that do not stop the stream. The call waits for a frame
+  // taken with the new values, so it is served by its own thread instead of
+  // stalling reconfigure and the other callbacks of the node
+  ros::NodeHandle enh(cnh);
+  enh.setCallbackQueue(&expose_queue_);
+  expose_srv_ =
+      enh.advertiseService("set_expose", &Bluefox2Ros::SetExposeCb, this);
+  expose_spinner_.reset(new ros::AsyncSpinner(1, &expose_queue_));
+  expose_spinner_->start();
+
+  // Latency and statistics of the capture pipeline, published at the
+  // diagnostic period
+  updater_.setHardwareID(camera_->serial());
+  const std::string name = prefix.empty() ? std::string() : prefix + " ";
+  updater_.add(name + "latency", this, &Bluefox2Ros::LatencyDiagnostic);
+  updater_.add(name + "statistics", this, &Bluefox2Ros::StatsDiagnostic);
+  updater_.add(name + "trigger", this, &Bluefox2Ros::TriggerDiagnostic);
+  updater_.add(name + "usb", this, &Bluefox2Ros::UsbDiagnostic);
+}
+
+bool Bluefox2Ros::HasSubscribers() const {
+  if (!lazy_) return true;
+  return image_pub_.getNumSubscribers() > 0 ||
+         metadata_pub_.getNumSubscribers() > 0 ||
+         fused_pub_.getNumSubscribers() > 0;
+}
+
+void Bluefox2Ros::SetStreaming(bool streaming) {
+  if (streaming == streaming_) return;
+  if (streaming) {
+    camera_->StartStreaming();
+  } else {
+    camera_->StopStreaming();
+    camera_->CancelRequests();
+  }
+  streaming_ = streaming;
+}
+
+sensor_msgs::ImagePtr Bluefox2Ros::AllocateImage() {
+  for (const sensor_msgs::ImagePtr& image_msg : pool_) {
+    // Nobody but the pool holds this message anymore
+    if (image_msg.use_count() == 1) return image_msg;
+  }
+  const auto image_msg = boost::make_shared<sensor_msgs::Image>();
+  if (pool_.size() < pool_size_) {
+    pool_.push_back(image_msg);
+  }
+  return image_msg;
+}
+
+void Bluefox2Ros::GrabAndPublish(const ros::Time& time) {
+  if (pool_size_) {
+    // Publish our own message instead of the one PublishCamera allocates
+    const auto image_msg = AllocateImage();
+    image_msg->header.stamp = time;
+    if (Grab(image_msg)) {
+      PublishImage(image_msg);
+    } else {
+      updater_.update();
+    }
+    return;
+  }
+
+  grabbed_ = false;
+  PublishCamera(time);
+  if (grabbed_) {
+    camera_->latency().Record(LatencyStage::kPublish, grab_end_);
+  }
+  updater_.update();
+}
+
+void Bluefox2Ros::PublishImage(const sensor_msgs::ImagePtr& image_msg) {
+  const auto start = LatencyClock::now();
+  Publish(image_msg);
+  camera_->latency().Record(LatencyStage::kPublish, start);
+  updater_.update();
 }
 
 bool Bluefox2Ros::Grab(const sensor_msgs::ImagePtr& image_msg,
                        const sensor_msgs::CameraInfoPtr& cinfo_msg) {
-  // Add expose time to current time stamp
-  return bluefox2_.GrabImage(*image_msg);
+  FrameMetadata metadata;
+  grabbed_ = camera_->GrabImage(*image_msg, &metadata);
+  grab_end_ = LatencyClock::now();
+  if (!grabbed_) return false;
+
+  if (!camera_->hw_stamp()) {
+    // Exposure of this very frame, the image was stamped at the request
+    const auto expose_duration = ros::Duration(metadata.expose_us * 1e-6 / 2);
+    image_msg->header.stamp += expose_duration;
+  }
+  PublishMetadata(metadata, image_msg->header.stamp);
+  ProcessGrabbed(*image_msg, metadata);
+  return true;
+}
+
+void Bluefox2Ros::ProcessGrabbed(const sensor_msgs::Image& image_msg,
+                                 const FrameMetadata& metadata) {
+  transfer_delay_.Record(metadata.transfer_delay_us);
+  if (rig_exposure_) rig_exposure_->Add(rig_index_, image_msg, metadata);
+  if (fuse_brackets_ && metadata.bracket >= 0) {
+    FuseBracket(image_msg, metadata.bracket);
+  }
+}
+
+void Bluefox2Ros::PublishMetadata(const FrameMetadata& metadata,
+                                  const ros::Time& stamp) {
+  if (metadata_pub_.getNumSubscribers() == 0) return;
+  const auto metadata_msg = boost::make_shared<Metadata>();
+  metadata_msg->header.stamp = stamp;
+  metadata_msg->header.frame_id = frame_id();
+  metadata_msg->frame_nr = metadata.frame_nr;
+  metadata_msg->expose_start_us = metadata.expose_start_us;
+  metadata_msg->expose_us = metadata.expose_us;
+  metadata_msg->gain_db = metadata.gain_db;
+  metadata_msg->transfer_delay_us = metadata.transfer_delay_us;
+  metadata_msg->io_states_start = metadata.io_states_start;
+  metadata_msg->io_states_end = metadata.io_states_end;
+  metadata_msg->bracket = metadata.bracket;
+  metadata_pub_.publish(metadata_msg);
+}
+
+void Bluefox2Ros::FuseBracket(const sensor_msgs::Image& image_msg,
+                              int bracket) {
+  if (fused_pub_.getNumSubscribers() == 0) {
+    fusion_.Reset();
+    return;
+  }
+  // A published message may still be read by subscribers
+  if (!fused_msg_) fused_msg_ = boost::make_shared<sensor_msgs::Image>();
+  if (fusion_.Add(image_msg, bracket, camera_->bracket_count(),
+                  *fused_msg_)) {
+    fused_pub_.publish(fused_msg_);
+    fused_msg_.reset();
+  }
+}
+
+bool Bluefox2Ros::SetExposeCb(SetExposeSrv::Request& req,
+                              SetExposeSrv::Response& res) {
+  // A camera waiting for a trigger may take a while to show the new values
+  static const int kExposeTimeoutMs = 1000;
+  res.expose_us = req.expose_us;
+  res.gain_db = req.gain_db;
+  res.frame_nr = camera_->SetExpose(res.expose_us, res.gain_db, req.set_gain,
+                                    kExposeTimeoutMs);
+  res.status = res.frame_nr >= 0;
+  return true;
+}
+
+void Bluefox2Ros::LatencyDiagnostic(
+    diagnostic_updater::DiagnosticStatusWrapper& stat) {
+  auto& latency = camera_->latency();
+  for (int i = 0; i < static_cast<int>(LatencyStage::kCount); ++i) {
+    const auto stage = static_cast<LatencyStage>(i);
+    const auto& histogram = latency.histogram(stage);
+    stat.addf(std::string(LatencyStageName(stage)) + " p50/p99/max [us]",
+              "%lld / %lld / %lld",
+              static_cast<long long>(histogram.Percentile(0.5)),
+              static_cast<long long>(histogram.Percentile(0.99)),
+              static_cast<long long>(histogram.max()));
+  }
+  stat.summary(diagnostic_msgs::DiagnosticStatus::OK,
+               "Latency since last update");
+  // Each update reports its own window
+  latency.Reset();
+}
+
+void Bluefox2Ros::StatsDiagnostic(
+    diagnostic_updater::DiagnosticStatusWrapper& stat) {
+  const auto stats = camera_->GetStats();
+  stat.add("frames per second", stats.frames_per_second);
+  stat.add("capture time [s]", stats.capture_time_s);
+  stat.add("bandwidth [KB/s]", stats.bandwidth_kbps);
+  stat.add("frame count", stats.frame_count);
+  stat.add("error count", stats.error_count);
+  stat.add("timed out requests", stats.timed_out_count);
+  stat.add("aborted requests", stats.aborted_count);
+  stat.add("lost images", stats.lost_images_count);
+  stat.add("incomplete frames", stats.incomplete_count);
+  stat.add("wait timeouts", stats.wait_timeouts);
+  stat.add("failed requests", stats.failed_requests);
+  stat.add("frame number gaps", stats.frame_nr_gaps);
+  stat.add("user buffer fallbacks", stats.user_buffer_fallbacks);
+
+  // Incomplete frames point at the usb bandwidth, timeouts at the trigger
+  if (stats.incomplete_count > last_stats_.incomplete_count ||
+      stats.lost_images_count > last_stats_.lost_images_count) {
+    stat.summary(diagnostic_msgs::DiagnosticStatus::WARN,
+                 "Frames lost or incomplete, check usb bandwidth");
+  } else if (stats.wait_timeouts > last_stats_.wait_timeouts) {
+    stat.summary(diagnostic_msgs::DiagnosticStatus::WARN,
+                 "Requests timed out, check trigger");
+  } else if (stats.failed_requests > last_stats_.failed_requests) {
+    stat.summary(diagnostic_msgs::DiagnosticStatus::WARN,
+                 "Requests returned with errors");
+  } else {
+    stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "No frames dropped");
+  }
+  last_stats_ = stats;
+}
+
+void Bluefox2Ros::TriggerDiagnostic(
+    diagnostic_updater::DiagnosticStatusWrapper& stat) {
+  FrameScheduler* scheduler = scheduler_;
+  if (!scheduler) {
+    last_overruns_ = 0;
+    stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "Not scheduled");
+    return;
+  }
+
+  auto& jitter = scheduler->jitter();
+  stat.addf("jitter p50/p99/max [us]", "%lld / %lld / %lld",
+            static_cast<long long>(jitter.Percentile(0.5)),
+            static_cast<long long>(jitter.Percentile(0.99)),
+            static_cast<long long>(jitter.max()));
+  const auto overruns = scheduler->overruns();
+  stat.add("overruns", overruns);
+  jitter.Reset();
+
+  // Overruns mean the loop takes longer than a frame period
+  if (overruns > last_overruns_) {
+    stat.summary(diagnostic_msgs::DiagnosticStatus::WARN,
+                 "Frames skipped, loop is slower than fps");
+  } else {
+    stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "On schedule");
+  }
+  last_overruns_ = overruns;
+}
+
+void Bluefox2Ros::UsbDiagnostic(
+    diagnostic_updater::DiagnosticStatusWrapper& stat) {
+  if (usb_planned_) {
+    stat.add("planned pixel clock [KHz]", usb_slot_.pclk_khz);
+    stat.add("planned trigger offset [us]", usb_slot_.offset_us);
+    stat.add("planned transfer time [us]", usb_slot_.transfer_us);
+    stat.add("planned peak rate [MB/s]", usb_slot_.peak_mbps);
+    stat.add("planned mean rate [MB/s]", usb_slot_.mean_mbps);
+  }
+  stat.addf("transfer delay p50/p99/max [us]", "%lld / %lld / %lld",
+            static_cast<long long>(transfer_delay_.Percentile(0.5)),
+            static_cast<long long>(transfer_delay_.Percentile(0.99)),
+            static_cast<long long>(transfer_delay_.max()));
+  const auto delayed = transfer_delay_.max() > 0;
+  transfer_delay_.Reset();
+
+  // The driver only delays transfers when the bus or the host is busy
+  if (delayed) {
+    stat.summary(diagnostic_msgs::DiagnosticStatus::WARN,
+                 "Transfers delayed, bus or host is overloaded");
+  } else {
+    stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "No transfer delays");
+  }
+}
+
+void OpenDevices(const ros::NodeHandle& pnh,
+                 const std::vector<std::string>& prefixes) {
+  std::vector<std::string> serials;
+  for (const std::string& prefix : prefixes) {
+    ros::NodeHandle cnh(pnh, prefix);
+    // Simulated cameras have nothing to open
+    std::string backend;
+    cnh.param<std::string>("backend", backend, "mvimpact");
+    if (backend == "sim") continue;
+    std::string identifier;
+    if (cnh.getParam("identifier", identifier)) {
+      serials.push_back(identifier);
+    }
+  }
+
+  const auto start = ros::WallTime::now();
+  const auto open_times = DeviceRegistry::Instance().OpenAll(serials);
+  for (const auto& open_time : open_times) {
+    ROS_INFO("%s: Opened %s in %.3f s", pnh.getNamespace().c_str(),
+             open_time.first.c_str(), open_time.second);
+  }
+  ROS_INFO("%s: Opened %zu cameras in %.3f s", pnh.getNamespace().c_str(),
+           open_times.size(), (ros::WallTime::now() - start).toSec());
 }
 
 }  // namespace bluefox2
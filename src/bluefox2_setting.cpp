@@ -1,11 +1,13 @@
 #include "bluefox2/bluefox2_setting.h"
 #include <sensor_msgs/image_encodings.h>
+#include <algorithm>
 
 namespace bluefox2 {
 
 using namespace sensor_msgs::image_encodings;
 
-std::string PixelFormatToEncoding(const TImageBufferPixelFormat& pixel_format) {
+const std::string& PixelFormatToEncoding(
+    const TImageBufferPixelFormat& pixel_format) {
   switch (pixel_format) {
     case ibpfMono8:
       return MONO8;
@@ -24,8 +26,8 @@ std::string PixelFormatToEncoding(const TImageBufferPixelFormat& pixel_format) {
   }
 }
 
-std::string BayerPatternToEncoding(const TBayerMosaicParity& bayer_pattern,
-                                   int bytes_per_pixel) {
+const std::string& BayerPatternToEncoding(
+    const TBayerMosaicParity& bayer_pattern, int bytes_per_pixel) {
   if (bytes_per_pixel == 1) {
     switch (bayer_pattern) {
       case bmpRG:
@@ -64,4 +66,15 @@ double PixelClockToFrameRate(int pclk_khz, double width, double height,
   return 1e6 / (frame_time_us + expose_us + kTriggerPulseWidthUs);
 }
 
+int PlanPixelClock(std::vector<int> pclks_khz, double fps, double width,
+                   double height, double expose_us) {
+  std::sort(pclks_khz.begin(), pclks_khz.end());
+  for (const int pclk_khz : pclks_khz) {
+    if (PixelClockToFrameRate(pclk_khz, width, height, expose_us) >= fps) {
+      return pclk_khz;
+    }
+  }
+  return pclks_khz.back();
+}
+
 }  // namespace bluefox2
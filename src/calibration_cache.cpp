@@ -0,0 +1,70 @@
+#include "bluefox2/calibration_cache.h"
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+namespace bluefox2 {
+
+static const char *const kWhiteBalanceTag = "white_balance";
+
+CalibrationCache::CalibrationCache(const std::string &path) : path_(path) {
+  Load();
+}
+
+bool CalibrationCache::Find(const CalibrationKey &key,
+                            WhiteBalanceGains &gains) const {
+  const auto it = white_balance_.find(MakeKey(key));
+  if (it == white_balance_.end()) return false;
+  gains = it->second;
+  return true;
+}
+
+bool CalibrationCache::Store(const CalibrationKey &key,
+                             const WhiteBalanceGains &gains) {
+  white_balance_[MakeKey(key)] = gains;
+  return Save();
+}
+
+CalibrationCache::Key CalibrationCache::MakeKey(const CalibrationKey &key) {
+  return Key(key.expose_us, std::llround(key.gain_db * 100),
+             key.pixel_clock_khz);
+}
+
+void CalibrationCache::Load() {
+  // One result per line: tag expose_us gain_db pixel_clock_khz values...
+  std::ifstream file(path_);
+  std::string line;
+  while (std::getline(file, line)) {
+    std::istringstream ss(line);
+    std::string tag;
+    CalibrationKey key;
+    WhiteBalanceGains gains;
+    if (ss >> tag >> key.expose_us >> key.gain_db >> key.pixel_clock_khz &&
+        tag == kWhiteBalanceTag &&
+        ss >> gains.r_gain >> gains.g_gain >> gains.b_gain) {
+      white_balance_[MakeKey(key)] = gains;
+    }
+  }
+}
+
+bool CalibrationCache::Save() const {
+  // Write a temporary file and rename it, so that a crash never leaves a
+  // truncated cache behind
+  const std::string tmp_path = path_ + ".tmp";
+  {
+    std::ofstream file(tmp_path);
+    if (!file) return false;
+    for (const auto &entry : white_balance_) {
+      file << kWhiteBalanceTag << ' ' << std::get<0>(entry.first) << ' '
+           << std::get<1>(entry.first) / 100.0 << ' '
+           << std::get<2>(entry.first) << ' ' << entry.second.r_gain << ' '
+           << entry.second.g_gain << ' ' << entry.second.b_gain << '\n';
+    }
+    if (!file) return false;
+  }
+  return std::rename(tmp_path.c_str(), path_.c_str()) == 0;
+}
+
+}  // namespace bluefox2
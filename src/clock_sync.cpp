@@ -0,0 +1,85 @@
+#include "bluefox2/clock_sync.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace bluefox2 {
+
+// Pairs further than this off the current estimate mean the camera clock has
+// been reset or the host clock jumped
+static const double kMaxResidualS = 1.0;
+// Crystal drift is a few tens of ppm, anything larger is not a clock
+static const double kMaxSkew = 1e-3;
+
+void ClockSync::Update(int64_t device_us, double host_s) {
+  if (samples_.empty()) {
+    origin_device_us_ = device_us;
+    origin_host_s_ = host_s;
+  }
+
+  Sample sample;
+  sample.device_s = (device_us - origin_device_us_) * 1e-6;
+  sample.offset_s = (host_s - origin_host_s_) - sample.device_s;
+
+  if (!samples_.empty()) {
+    const double residual =
+        sample.offset_s - (offset_s_ + skew_ * sample.device_s);
+    if (sample.device_s < samples_.back().device_s ||
+        std::abs(residual) > kMaxResidualS) {
+      Reset();
+      Update(device_us, host_s);
+      return;
+    }
+  }
+
+  samples_.push_back(sample);
+  if (samples_.size() > window_) {
+    samples_.pop_front();
+  }
+  Fit();
+}
+
+double ClockSync::ToHost(int64_t device_us) const {
+  if (samples_.empty()) return 0;
+  const double device_s = (device_us - origin_device_us_) * 1e-6;
+  return origin_host_s_ + device_s + offset_s_ + skew_ * device_s;
+}
+
+void ClockSync::Fit() {
+  if (samples_.size() < 2) {
+    skew_ = 0;
+    offset_s_ = samples_.front().offset_s;
+    return;
+  }
+
+  // Lower convex hull of the pairs, device time is increasing already
+  std::vector<const Sample *> hull;
+  for (const Sample &s : samples_) {
+    while (hull.size() >= 2) {
+      const Sample &a = *hull[hull.size() - 2];
+      const Sample &b = *hull.back();
+      const double cross = (b.device_s - a.device_s) * (s.offset_s - a.offset_s) -
+                           (b.offset_s - a.offset_s) * (s.device_s - a.device_s);
+      if (cross > 0) break;
+      hull.pop_back();
+    }
+    hull.push_back(&s);
+  }
+
+  // The hull edge below the middle of the window is the line that lies under
+  // all pairs with the least total distance to them
+  const double mid_s =
+      (samples_.front().device_s + samples_.back().device_s) / 2;
+  size_t i = 1;
+  while (i + 1 < hull.size() && hull[i]->device_s < mid_s) ++i;
+  const Sample &a = *hull[i - 1];
+  const Sample &b = *hull[i];
+  // Repeated camera stamps give no slope, keep the previous fit
+  if (b.device_s <= a.device_s) return;
+  skew_ = (b.offset_s - a.offset_s) / (b.device_s - a.device_s);
+  skew_ = std::max(-kMaxSkew, std::min(kMaxSkew, skew_));
+  offset_s_ = a.offset_s - skew_ * a.device_s;
+}
+
+}  // namespace bluefox2
@@ -0,0 +1,84 @@
+#include "bluefox2/device_registry.h"
+
+#include <chrono>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+
+namespace bluefox2 {
+
+using namespace mvIMPACT::acquire;
+
+DeviceRegistry &DeviceRegistry::Instance() {
+  static DeviceRegistry registry;
+  return registry;
+}
+
+Device *DeviceRegistry::Open(const std::string &serial) {
+  Device *dev = Find(serial);
+  if (!dev->isOpen()) {
+    try {
+      dev->open();
+    } catch (const ImpactAcquireException &e) {
+      throw std::runtime_error(serial + ": " + e.what());
+    }
+  }
+  return dev;
+}
+
+std::map<std::string, double> DeviceRegistry::OpenAll(
+    const std::vector<std::string> &serials) {
+  // Opening uploads settings to each camera and is mostly spent waiting on
+  // usb, so the devices are opened side by side
+  std::vector<double> open_s(serials.size(), 0);
+  std::vector<std::exception_ptr> errors(serials.size());
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < serials.size(); ++i) {
+    threads.emplace_back([&, i] {
+      const auto start = std::chrono::steady_clock::now();
+      try {
+        Open(serials[i]);
+      } catch (...) {
+        errors[i] = std::current_exception();
+      }
+      open_s[i] = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start).count();
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  for (const std::exception_ptr &error : errors) {
+    if (error) std::rethrow_exception(error);
+  }
+  std::map<std::string, double> open_times;
+  for (size_t i = 0; i < serials.size(); ++i) {
+    open_times[serials[i]] = open_s[i];
+  }
+  return open_times;
+}
+
+std::string DeviceRegistry::AvailableDevices() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto dev_cnt = dev_mgr_.deviceCount();
+  std::string devices = std::to_string(dev_cnt) + " availabe device(s): ";
+  for (decltype(dev_mgr_.deviceCount()) i = 0; i < dev_cnt; ++i) {
+    devices += dev_mgr_.getDevice(i)->serial.read() + " ";
+  }
+  return devices;
+}
+
+Device *DeviceRegistry::Find(const std::string &serial) {
+  Device *dev = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    dev = dev_mgr_.getDeviceBySerial(serial);
+  }
+  if (!dev) {
+    throw std::runtime_error(serial + " not found. " + AvailableDevices());
+  }
+  return dev;
+}
+
+}  // namespace bluefox2
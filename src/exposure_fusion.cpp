@@ -0,0 +1,80 @@
+#include "bluefox2/exposure_fusion.h"
+#include <sensor_msgs/image_encodings.h>
+
+namespace bluefox2 {
+
+bool ExposureFusion::Add(const sensor_msgs::Image &image_msg, int bracket,
+                         int bracket_count, sensor_msgs::Image &fused_msg) {
+  if (bracket == 0) {
+    // Every bracket starts over, even if the last one was not complete
+    next_ = 0;
+    if (!Start(image_msg)) return false;
+  } else if (bracket != next_ || !Matches(image_msg)) {
+    // A frame of this bracket was lost or the format changed under it
+    next_ = 0;
+    return false;
+  }
+
+  Accumulate(image_msg);
+  if (++next_ < bracket_count) return false;
+  next_ = 0;
+  Compose(image_msg, fused_msg);
+  return true;
+}
+
+bool ExposureFusion::Start(const sensor_msgs::Image &image_msg) {
+  if (sensor_msgs::image_encodings::bitDepth(image_msg.encoding) != 8 ||
+      image_msg.data.size() != image_msg.step * image_msg.height) {
+    return false;
+  }
+  stamp_ = image_msg.header.stamp;
+  encoding_ = image_msg.encoding;
+  sum_.assign(image_msg.data.size(), 0.f);
+  weight_sum_.assign(image_msg.data.size(), 0.f);
+  return true;
+}
+
+bool ExposureFusion::Matches(const sensor_msgs::Image &image_msg) const {
+  return image_msg.data.size() == sum_.size() &&
+         image_msg.encoding == encoding_;
+}
+
+void ExposureFusion::Accumulate(const sensor_msgs::Image &image_msg) {
+  // Keeps fully clipped samples defined, they average over the bracket
+  static const float kMinWeight = 1.f;
+  const uint8_t *src = image_msg.data.data();
+  float *sum = sum_.data();
+  float *weight_sum = weight_sum_.data();
+  const size_t n = sum_.size();
+  // Branch free so that the compiler vectorizes it, padding at the end of
+  // each row is fused along with the pixels
+  for (size_t i = 0; i < n; ++i) {
+    const float value = src[i];
+    const float weight = kMinWeight + value * (255.f - value);
+    sum[i] += weight * value;
+    weight_sum[i] += weight;
+  }
+}
+
+void ExposureFusion::Compose(const sensor_msgs::Image &image_msg,
+                             sensor_msgs::Image &fused_msg) const {
+  fused_msg.header.frame_id = image_msg.header.frame_id;
+  fused_msg.header.stamp =
+      stamp_ + (image_msg.header.stamp - stamp_) * 0.5;
+  fused_msg.encoding = image_msg.encoding;
+  fused_msg.height = image_msg.height;
+  fused_msg.width = image_msg.width;
+  fused_msg.step = image_msg.step;
+  fused_msg.is_bigendian = image_msg.is_bigendian;
+  fused_msg.data.resize(sum_.size());
+
+  uint8_t *dst = fused_msg.data.data();
+  const float *sum = sum_.data();
+  const float *weight_sum = weight_sum_.data();
+  const size_t n = sum_.size();
+  for (size_t i = 0; i < n; ++i) {
+    dst[i] = static_cast<uint8_t>(sum[i] / weight_sum[i] + 0.5f);
+  }
+}
+
+}  // namespace bluefox2
@@ -0,0 +1,71 @@
+#include "bluefox2/frame_scheduler.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace bluefox2 {
+
+using std::chrono::duration_cast;
+
+FrameScheduler::FrameScheduler(double fps, bool align,
+                               Clock::duration offset)
+    : align_(align), offset_(offset) {
+  if (fps > 0) {
+    period_ = duration_cast<Clock::duration>(
+        std::chrono::duration<double>(1.0 / fps));
+  }
+}
+
+FrameScheduler::Clock::time_point FrameScheduler::Wait() {
+  const auto now = Clock::now();
+  if (period_ <= Clock::duration::zero()) return now;
+
+  const bool fixed_grid = align_ || shared_origin_;
+  if (!started_ && !fixed_grid) origin_ = now;
+  const auto grid_now = GridTime(now);
+  // Rounded down, a shared origin may lie after now by the offset
+  int64_t slot_now = grid_now / period_;
+  if (grid_now < Clock::duration::zero() &&
+      grid_now % period_ != Clock::duration::zero()) {
+    --slot_now;
+  }
+  if (!started_) {
+    // Fixed grids start on the next boundary, others right away
+    next_slot_ = fixed_grid ? slot_now + 1 : slot_now;
+    started_ = true;
+  } else if (slot_now > next_slot_) {
+    // Missed whole slots, skip them and keep the phase of the grid
+    overruns_ += slot_now - next_slot_;
+    next_slot_ = slot_now;
+  }
+
+  const auto deadline = now + (next_slot_ * period_ - grid_now);
+  std::this_thread::sleep_until(deadline);
+  const auto late = Clock::now() - deadline;
+  jitter_.Record(duration_cast<std::chrono::microseconds>(late).count());
+  ++next_slot_;
+  return deadline;
+}
+
+void FrameScheduler::Pause() {
+  // Short enough that the first frame after a pause is not held back by it
+  static const Clock::duration kMaxPause = std::chrono::milliseconds(10);
+  const bool periodic = period_ > Clock::duration::zero();
+  std::this_thread::sleep_for(periodic ? std::min(period_, kMaxPause)
+                                       : kMaxPause);
+  started_ = false;
+}
+
+FrameScheduler::Clock::duration FrameScheduler::GridTime(
+    const Clock::time_point &now) const {
+  // Aligned grids follow the system clock at every slot, so that they stay
+  // in phase with other hosts while sleeping on the steady clock
+  if (align_) {
+    return duration_cast<Clock::duration>(
+               std::chrono::system_clock::now().time_since_epoch()) -
+           offset_;
+  }
+  return now - origin_ - offset_;
+}
+
+}  // namespace bluefox2
@@ -0,0 +1,77 @@
+#include "bluefox2/latency.h"
+
+namespace bluefox2 {
+
+constexpr int Histogram::kBuckets;
+
+void Histogram::Record(int64_t us) {
+  if (us < 0) us = 0;
+  buckets_[Bucket(us)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  int64_t max = max_.load(std::memory_order_relaxed);
+  while (us > max &&
+         !max_.compare_exchange_weak(max, us, std::memory_order_relaxed)) {
+  }
+}
+
+int64_t Histogram::Percentile(double p) const {
+  std::array<uint32_t, kBuckets> counts;
+  uint64_t total = 0;
+  for (int i = 0; i < kBuckets; ++i) {
+    counts[i] = buckets_[i].load(std::memory_order_relaxed);
+    total += counts[i];
+  }
+  if (total == 0) return 0;
+
+  const uint64_t rank = p * (total - 1);
+  uint64_t seen = 0;
+  for (int i = 0; i < kBuckets; ++i) {
+    seen += counts[i];
+    if (seen > rank) {
+      return (BucketLow(i) + BucketLow(i + 1)) / 2;
+    }
+  }
+  return max();
+}
+
+void Histogram::Reset() {
+  for (auto &bucket : buckets_) {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+  count_.store(0, std::memory_order_relaxed);
+  max_.store(0, std::memory_order_relaxed);
+}
+
+int Histogram::Bucket(int64_t us) {
+  if (us < kSubBuckets) return us;
+  const int msb = 63 - __builtin_clzll(us);
+  if (msb >= kMaxBits) return kBuckets - 1;
+  const int sub = (us >> (msb - kSubBits)) - kSubBuckets;
+  return kSubBuckets * (msb - kSubBits + 1) + sub;
+}
+
+int64_t Histogram::BucketLow(int bucket) {
+  if (bucket < kSubBuckets) return bucket;
+  const int msb = bucket / kSubBuckets + kSubBits - 1;
+  const int sub = bucket % kSubBuckets;
+  return static_cast<int64_t>(kSubBuckets + sub) << (msb - kSubBits);
+}
+
+const char *LatencyStageName(LatencyStage stage) {
+  switch (stage) {
+    case LatencyStage::kRequest:
+      return "request";
+    case LatencyStage::kWait:
+      return "wait";
+    case LatencyStage::kFrameInfo:
+      return "frame info";
+    case LatencyStage::kCopy:
+      return "copy";
+    case LatencyStage::kPublish:
+      return "publish";
+    default:
+      return "unknown";
+  }
+}
+
+}  // namespace bluefox2
@@ -1,19 +1,107 @@
 #include "bluefox2/multi_node.h"
 #include "bluefox2/bluefox2_ros.h"
 
+#include <pthread.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
 namespace bluefox2 {
 
+// How often a paused stream checks for subscribers
+static const auto kIdlePoll = std::chrono::milliseconds(10);
+
+/**
+ * @brief The StampBarrier class
+ * Blocks the capture threads of synced cameras until all of them have
+ * requested an image, and hands them a common time stamp
+ */
+class StampBarrier {
+ public:
+  explicit StampBarrier(size_t count) : count_(count) {}
+
+  /**
+   * @brief Wait Wait for the other cameras
+   * @param time Time stamp of this camera
+   * @return Earliest time stamp of all cameras, time once aborted
+   */
+  ros::Time Wait(const ros::Time &time) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (aborted_) return time;
+    if (arrived_ == 0 || time < stamp_) stamp_ = time;
+    if (++arrived_ >= count_) {
+      Release();
+      return released_stamp_;
+    }
+    const auto generation = generation_;
+    cond_.wait(lock, [&] { return generation != generation_ || aborted_; });
+    return generation != generation_ ? released_stamp_ : time;
+  }
+
+  /**
+   * @brief Leave Stop taking part, so that the others do not wait for us
+   */
+  void Leave() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    --count_;
+    if (arrived_ > 0 && arrived_ >= count_) Release();
+  }
+
+  /**
+   * @brief Abort Wake up all waiting cameras and stop waiting from now on
+   */
+  void Abort() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    aborted_ = true;
+    cond_.notify_all();
+  }
+
+ private:
+  void Release() {
+    released_stamp_ = stamp_;
+    arrived_ = 0;
+    ++generation_;
+    cond_.notify_all();
+  }
+
+  size_t count_;
+  size_t arrived_{0};
+  size_t generation_{0};
+  bool aborted_{false};
+  ros::Time stamp_;
+  ros::Time released_stamp_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+};
+
+/**
+ * @brief The BarrierLeave struct Leaves the barrier on every way out of a
+ * capture thread
+ */
+struct BarrierLeave {
+  explicit BarrierLeave(StampBarrier *barrier) : barrier(barrier) {}
+  ~BarrierLeave() {
+    if (barrier) barrier->Leave();
+  }
+  StampBarrier *barrier;
+};
+
 MultiNode::MultiNode(const ros::NodeHandle& pnh) : CameraNodeBase(pnh) {
   int num_cameras;
   if (!pnh.getParam("num_cameras", num_cameras)) {
     throw std::runtime_error("Could not find parameter num_cameras");
   }
+  pnh.param<bool>("align_triggers", align_triggers_, false);
+  pnh.param<bool>("rig_aec", rig_aec_, false);
+  pnh.param<double>("usb_budget_mbps", usb_budget_mbps_, 0.0);
+  std::vector<std::string> cameras;
   for (int i = 0; i < num_cameras; ++i) {
     const std::string camera = "camera" + std::to_string(i);
     ros::NodeHandle cnh(pnh, camera);
-    std::string camera_name;
-    if (cnh.getParam("camera_name", camera_name)) {
-      multi_ros_.push_back(boost::make_shared<Bluefox2Ros>(pnh, camera));
+    if (cnh.hasParam("camera_name")) {
+      cameras.push_back(camera);
     } else {
       ROS_WARN(
           "Multi camera system has %d cameras"
@@ -21,35 +109,238 @@ MultiNode::MultiNode(const ros::NodeHandle& pnh) : CameraNodeBase(pnh) {
           num_cameras, i);
     }
   }
+
+  // Open all cameras at once instead of one after another
+  OpenDevices(pnh, cameras);
+  for (const std::string& camera : cameras) {
+    ros::NodeHandle cnh(pnh, camera);
+    multi_ros_.push_back(boost::make_shared<Bluefox2Ros>(pnh, camera));
+    int cpu;
+    cnh.param<int>("cpu", cpu, -1);
+    multi_cpu_.push_back(cpu);
+    bool sync;
+    cnh.param<bool>("sync", sync, false);
+    multi_sync_.push_back(sync);
+    multi_offset_us_.push_back(0);
+  }
+
+  std::vector<CameraBackend*> rig;
+  for (const Bluefox2RosPtr& bf2_ros : multi_ros_) {
+    rig.push_back(&bf2_ros->camera());
+  }
+  rig_exposure_.reset(new RigExposure(rig));
 }
 
+MultiNode::~MultiNode() = default;
+
 void MultiNode::Acquire() {
+  // One capture thread per camera, so that a slow camera only delays the
+  // cameras that are synced with it
+  StampBarrier barrier(
+      std::count(multi_sync_.cbegin(), multi_sync_.cend(), true));
+  rig_origin_ = FrameScheduler::Clock::now();
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < multi_ros_.size(); ++i) {
+    threads.emplace_back(&MultiNode::AcquireCamera, this, multi_ros_[i],
+                         multi_sync_[i] ? &barrier : nullptr,
+                         multi_offset_us_[i]);
+    if (multi_cpu_[i] >= 0) {
+      cpu_set_t cpu_set;
+      CPU_ZERO(&cpu_set);
+      CPU_SET(multi_cpu_[i], &cpu_set);
+      if (pthread_setaffinity_np(threads.back().native_handle(),
+                                 sizeof(cpu_set), &cpu_set)) {
+        ROS_WARN("%s: Failed to pin camera %zu to cpu %d",
+                 pnh().getNamespace().c_str(), i, multi_cpu_[i]);
+      }
+    }
+  }
+  // A camera that stops delivering would keep the others in the barrier
+  while (is_acquire() && ros::ok()) {
+    std::this_thread::sleep_for(kIdlePoll);
+  }
+  barrier.Abort();
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
+
+bool MultiNode::HasSubscribers() const {
+  // Synced cameras and the rig exposure need frames from every camera, so the
+  // rig only pauses as a whole
+  return std::any_of(
+      multi_ros_.cbegin(), multi_ros_.cend(),
+      [](const Bluefox2RosPtr& bf2_ros) { return bf2_ros->HasSubscribers(); });
+}
+
+void MultiNode::AcquireCamera(const Bluefox2RosPtr& bf2_ros,
+                              StampBarrier* barrier, double offset_us) {
+  const BarrierLeave leave(barrier);
+  // The real time controller of the camera paces its triggers
+  if (bf2_ros->camera().hardware_timed()) {
+    AcquireCameraStream(bf2_ros, barrier);
+    return;
+  }
+
+  // All grids start at the rig origin, or on the system clock when aligned,
+  // so the cameras are triggered in phase up to the offsets that keep their
+  // transfers apart
+  FrameScheduler scheduler(
+      bf2_ros->fps(), align_triggers_,
+      std::chrono::duration_cast<FrameScheduler::Clock::duration>(
+          std::chrono::duration<double, std::micro>(offset_us)));
+  scheduler.set_origin(rig_origin_);
+  bf2_ros->set_scheduler(&scheduler);
   while (is_acquire() && ros::ok()) {
-    for (const Bluefox2RosPtr& bf2_ros : multi_ros_) {
-      bf2_ros->RequestSingle();
+    if (!HasSubscribers()) {
+      scheduler.Pause();
+      continue;
     }
-    // For now just use the first camera's exposure time to compensate
-    const auto expose_us = multi_ros_.front()->camera().GetExposeUs();
-    const auto expose_duration = ros::Duration(expose_us * 1e-6 / 2);
-    const auto time = ros::Time::now() + expose_duration;
-    for (const Bluefox2RosPtr& bf2_ros : multi_ros_) {
-      bf2_ros->PublishCamera(time);
+    scheduler.Wait();
+    bf2_ros->RequestSingle();
+    auto time = ros::Time::now();
+    if (barrier) {
+      time = barrier->Wait(time);
     }
-    Sleep();
+    bf2_ros->GrabAndPublish(time);
   }
+  bf2_ros->set_scheduler(nullptr);
+}
+
+void MultiNode::AcquireCameraStream(const Bluefox2RosPtr& bf2_ros,
+                                    StampBarrier* barrier) {
+  auto& camera = bf2_ros->camera();
+  while (is_acquire() && ros::ok()) {
+    const bool active = HasSubscribers();
+    bf2_ros->SetStreaming(active);
+    if (!active) {
+      std::this_thread::sleep_for(kIdlePoll);
+      continue;
+    }
+
+    const auto image_msg = bf2_ros->AllocateImage();
+    FrameMetadata metadata;
+    if (!camera.GrabImage(*image_msg, &metadata)) continue;
+    // The frame has just arrived, so the middle of the exposure is behind us
+    const auto expose_duration = ros::Duration(metadata.expose_us * 1e-6 / 2);
+    auto time = ros::Time::now() - expose_duration;
+    if (barrier) {
+      time = barrier->Wait(time);
+    }
+    if (!camera.hw_stamp()) image_msg->header.stamp = time;
+    bf2_ros->PublishMetadata(metadata, image_msg->header.stamp);
+    bf2_ros->ProcessGrabbed(*image_msg, metadata);
+    bf2_ros->PublishImage(image_msg);
+  }
+  bf2_ros->SetStreaming(false);
 }
 
 void MultiNode::Setup(Bluefox2DynConfig& config) {
-  if (config.aec != 0) {
+  const bool rig_aec = rig_aec_ && config.aec;
+  if (rig_aec) {
+    rig_exposure_->Configure(config, config.fps);
+  } else if (config.aec != 0) {
     ROS_WARN(
         "%s: Not recommend to use aec (auto expose control) in a "
-        "multi-camera system",
+        "multi-camera system without rig_aec",
         pnh().getNamespace().c_str());
   }
   // TODO: config is messed up here
-  for (const Bluefox2RosPtr& bf2_ros : multi_ros_) {
-    bf2_ros->set_fps(config.fps);
-    bf2_ros->camera().Configure(config);
+  std::vector<Bluefox2DynConfig> configs;
+  for (size_t i = 0; i < multi_ros_.size(); ++i) {
+    const Bluefox2RosPtr& bf2_ros = multi_ros_[i];
+    if (rig_aec) {
+      // The sensors take exposure and gain from the rig instead
+      auto camera_config = config;
+      camera_config.aec = false;
+      camera_config.agc = false;
+      bf2_ros->camera().Configure(camera_config);
+      configs.push_back(camera_config);
+    } else {
+      bf2_ros->camera().Configure(config);
+      configs.push_back(config);
+    }
+    bf2_ros->set_rig_exposure(rig_aec ? rig_exposure_.get() : nullptr, i);
+  }
+
+  std::fill(multi_offset_us_.begin(), multi_offset_us_.end(), 0);
+  if (usb_budget_mbps_ > 0) PlanUsb(config, configs);
+  for (size_t i = 0; i < multi_ros_.size(); ++i) {
+    multi_ros_[i]->set_fps(configs[i].fps);
+  }
+}
+
+/**
+ * @brief ReachesFps Whether a camera keeps its fps at a pixel clock
+ */
+static bool ReachesFps(const UsbDemand& demand, int pclk_khz) {
+  return std::find(demand.pclks_khz.cbegin(), demand.pclks_khz.cend(),
+                   pclk_khz) != demand.pclks_khz.cend() &&
+         PixelClockToFrameRate(pclk_khz, demand.width, demand.height,
+                               demand.expose_us) >= demand.fps;
+}
+
+/**
+ * @brief LowestPixelClock Lowest pixel clock of a plan, 0 for an empty one
+ */
+static int LowestPixelClock(const UsbPlan& plan) {
+  int pclk_khz = 0;
+  for (const UsbSlot& slot : plan.slots) {
+    if (pclk_khz == 0 || slot.pclk_khz < pclk_khz) pclk_khz = slot.pclk_khz;
+  }
+  return pclk_khz;
+}
+
+void MultiNode::PlanUsb(Bluefox2DynConfig& config,
+                        std::vector<Bluefox2DynConfig>& configs) {
+  std::vector<UsbDemand> demands;
+  for (size_t i = 0; i < multi_ros_.size(); ++i) {
+    demands.push_back(
+        MakeUsbDemand(configs[i], multi_ros_[i]->camera().pixel_clocks()));
+  }
+  // Offsets would split the common stamp of synced cameras
+  const bool stagger =
+      std::none_of(multi_sync_.cbegin(), multi_sync_.cend(),
+                   [](bool sync) { return sync; }) &&
+      std::all_of(configs.cbegin(), configs.cend(),
+                  [](const Bluefox2DynConfig& camera_config) {
+                    return camera_config.ctm == Bluefox2Dyn_ctm_on_demand;
+                  });
+  auto plan = PlanUsbBandwidth(demands, usb_budget_mbps_, stagger);
+
+  // The cameras share one config, so a lowered clock goes to all of them and
+  // is reported back in it
+  if (!plan.staggered && LowestPixelClock(plan) < config.cpc) {
+    const int pclk_khz = LowestPixelClock(plan);
+    for (UsbDemand& demand : demands) {
+      if (ReachesFps(demand, pclk_khz)) demand.pclk_khz = pclk_khz;
+    }
+    plan = PlanUsbBandwidth(demands, usb_budget_mbps_, false);
+    config.cpc = LowestPixelClock(plan);
+  }
+
+  for (size_t i = 0; i < multi_ros_.size(); ++i) {
+    const UsbSlot& slot = plan.slots[i];
+    Bluefox2Ros& bf2_ros = *multi_ros_[i];
+    if (slot.pclk_khz != configs[i].cpc) {
+      configs[i].cpc = slot.pclk_khz;
+      configs[i].cpc_auto = false;
+      bf2_ros.camera().Configure(configs[i]);
+    }
+    multi_offset_us_[i] = slot.offset_us;
+    bf2_ros.set_usb_slot(slot);
+    ROS_INFO("%s: %s at %d KHz, trigger offset %.0f us, peak %.1f MB/s",
+             pnh().getNamespace().c_str(), bf2_ros.camera().serial().c_str(),
+             slot.pclk_khz, slot.offset_us, slot.peak_mbps);
+  }
+  if (plan.within_budget) {
+    ROS_INFO("%s: usb peak %.1f MB/s, mean %.1f MB/s of %.1f MB/s%s",
+             pnh().getNamespace().c_str(), plan.peak_mbps, plan.mean_mbps,
+             usb_budget_mbps_, plan.staggered ? ", staggered" : "");
+  } else {
+    ROS_WARN("%s: usb peak %.1f MB/s exceeds the budget of %.1f MB/s, "
+             "lower fps or the area of interest",
+             pnh().getNamespace().c_str(), plan.peak_mbps, usb_budget_mbps_);
   }
 }
 
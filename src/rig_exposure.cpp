@@ -0,0 +1,149 @@
+#include "bluefox2/rig_exposure.h"
+#include "bluefox2/camera_backend.h"
+#include <sensor_msgs/image_encodings.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace bluefox2 {
+
+BrightnessStats MeasureBrightness(const sensor_msgs::Image &image_msg,
+                                  int row_stride) {
+  // Samples at or above this count as clipped
+  static const uint8_t kClipValue = 250;
+  BrightnessStats stats;
+  if (sensor_msgs::image_encodings::bitDepth(image_msg.encoding) != 8) {
+    return stats;
+  }
+  const size_t row_bytes =
+      image_msg.width *
+      sensor_msgs::image_encodings::numChannels(image_msg.encoding);
+  if (row_bytes > image_msg.step ||
+      image_msg.data.size() < image_msg.step * image_msg.height) {
+    return stats;
+  }
+
+  row_stride = std::max(row_stride, 1);
+  uint64_t sum = 0;
+  uint64_t clipped = 0;
+  for (uint32_t row = 0; row < image_msg.height; row += row_stride) {
+    const uint8_t *src = &image_msg.data[row * image_msg.step];
+    // Narrow accumulators per row keep the inner loop vectorized
+    uint32_t row_sum = 0;
+    uint32_t row_clipped = 0;
+    for (size_t i = 0; i < row_bytes; ++i) {
+      row_sum += src[i];
+      row_clipped += src[i] >= kClipValue;
+    }
+    sum += row_sum;
+    clipped += row_clipped;
+    stats.samples += row_bytes;
+  }
+  if (stats.samples == 0) return stats;
+  stats.mean = sum / (255.0 * stats.samples);
+  stats.clipped = static_cast<double>(clipped) / stats.samples;
+  return stats;
+}
+
+RigExposure::RigExposure(const std::vector<CameraBackend *> &cameras)
+    : cameras_(cameras), samples_(cameras.size()) {}
+
+void RigExposure::Configure(const Bluefox2DynConfig &config, double fps) {
+  // Upper limit of expose_us in the config
+  static const double kMaxExposeUs = 100000;
+  std::lock_guard<std::mutex> lock(mutex_);
+  target_ = config.des_grey_value / 255.0;
+  auto_gain_ = config.agc;
+  fixed_gain_db_ = config.gain_db;
+  max_expose_us_ = fps > 0 ? std::min(1e6 / fps, kMaxExposeUs) : kMaxExposeUs;
+  // Frames in flight were taken with the old settings
+  for (Sample &sample : samples_) {
+    sample.fresh = false;
+  }
+  fresh_ = 0;
+}
+
+void RigExposure::Add(size_t index, const sensor_msgs::Image &image_msg,
+                      const FrameMetadata &metadata) {
+  // Measured in the capture thread of each camera, outside the lock
+  const auto stats = MeasureBrightness(image_msg);
+  if (stats.samples == 0 || index >= samples_.size()) return;
+
+  int expose_us = 0;
+  double gain_db = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Sample &sample = samples_[index];
+    sample.stats = stats;
+    sample.expose_us = metadata.expose_us;
+    sample.gain_db = metadata.gain_db;
+    if (!sample.fresh) {
+      sample.fresh = true;
+      ++fresh_;
+    }
+    if (fresh_ < samples_.size()) return;
+    if (!Step(expose_us, gain_db)) return;
+  }
+
+  // The next frame of every camera is taken with the same values
+  for (CameraBackend *camera : cameras_) {
+    int camera_expose_us = expose_us;
+    double camera_gain_db = gain_db;
+    camera->SetExpose(camera_expose_us, camera_gain_db, true, 0);
+  }
+}
+
+bool RigExposure::Step(int &expose_us, double &gain_db) {
+  // Fraction of the error corrected per step in stops, frames that are
+  // already exposing with the old values would make a full step overshoot
+  static const double kDamping = 0.6;
+  static const double kMaxRatio = 4;
+  // Relative brightness error that is left alone, so the rig settles
+  static const double kDeadband = 0.03;
+  static const double kMaxClipped = 0.05;
+  static const double kMinExposeUs = 10;
+  static const double kMaxGainDb = 12;
+
+  // Exposure times linear gain of the frames, brightness is proportional
+  // to it as long as the image is not clipped
+  double mean = 0;
+  double clipped = 0;
+  double exposure = 0;
+  size_t samples = 0;
+  for (Sample &sample : samples_) {
+    mean += sample.stats.mean * sample.stats.samples;
+    clipped += sample.stats.clipped * sample.stats.samples;
+    samples += sample.stats.samples;
+    exposure += sample.expose_us * std::pow(10.0, sample.gain_db / 20);
+    sample.fresh = false;
+  }
+  fresh_ = 0;
+  mean /= samples;
+  clipped /= samples;
+  exposure /= samples_.size();
+  // An image with large white areas is brighter than its mean shows, a few
+  // highlights are left clipped
+  if (clipped > kMaxClipped) mean = std::max(mean, target_ * (1 + clipped));
+
+  const double error = target_ / std::max(mean, 1.0 / 255);
+  if (std::abs(error - 1) < kDeadband) return false;
+  const double ratio = std::min(std::max(std::pow(error, kDamping),
+                                         1 / kMaxRatio), kMaxRatio);
+  exposure *= ratio;
+
+  // Longer exposure before more gain, gain only makes up for the frame period
+  double expose = 0;
+  if (auto_gain_) {
+    expose = std::min(std::max(exposure, kMinExposeUs), max_expose_us_);
+    gain_db = std::min(std::max(20 * std::log10(exposure / expose), 0.0),
+                       kMaxGainDb);
+  } else {
+    gain_db = fixed_gain_db_;
+    expose = std::min(std::max(exposure / std::pow(10.0, gain_db / 20),
+                               kMinExposeUs), max_expose_us_);
+  }
+  expose_us = static_cast<int>(expose + 0.5);
+  return true;
+}
+
+}  // namespace bluefox2
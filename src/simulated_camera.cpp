@@ -0,0 +1,339 @@
+#include "bluefox2/simulated_camera.h"
+#include <sensor_msgs/image_encodings.h>
+
+#include <dirent.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+namespace bluefox2 {
+
+namespace enc = sensor_msgs::image_encodings;
+
+/**
+ * @brief ReadPnmValue Read a header value, skipping comments
+ */
+static bool ReadPnmValue(std::istream &in, int &value) {
+  in >> std::ws;
+  while (in.peek() == '#') {
+    in.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    in >> std::ws;
+  }
+  return static_cast<bool>(in >> value);
+}
+
+/**
+ * @brief ReadPnm Read a binary 8 bit pgm (mono8) or ppm (rgb8) file
+ */
+static bool ReadPnm(const std::string &path, sensor_msgs::Image &image_msg) {
+  std::ifstream file(path, std::ios::binary);
+  std::string magic;
+  if (!(file >> magic) || (magic != "P5" && magic != "P6")) return false;
+  int width = 0, height = 0, max_value = 0;
+  if (!ReadPnmValue(file, width) || !ReadPnmValue(file, height) ||
+      !ReadPnmValue(file, max_value) || max_value > 255) {
+    return false;
+  }
+  // Exactly one whitespace separates the header from the pixels
+  file.get();
+
+  const int channels = magic == "P5" ? 1 : 3;
+  image_msg.encoding = channels == 1 ? enc::MONO8 : enc::RGB8;
+  image_msg.width = width;
+  image_msg.height = height;
+  image_msg.step = width * channels;
+  image_msg.is_bigendian = 0;
+  image_msg.data.resize(image_msg.step * height);
+  file.read(reinterpret_cast<char *>(image_msg.data.data()),
+            image_msg.data.size());
+  return file.gcount() == static_cast<std::streamsize>(image_msg.data.size());
+}
+
+SimulatedCamera::SimulatedCamera(const std::string &serial, double latency_ms,
+                                 const std::string &replay)
+    : serial_(serial),
+      transfer_delay_(std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double, std::milli>(latency_ms))),
+      origin_(Clock::now()),
+      config_(Bluefox2DynConfig::__getDefault__()) {
+  if (!replay.empty()) LoadReplay(replay);
+}
+
+void SimulatedCamera::LoadReplay(const std::string &dir) {
+  std::vector<std::string> names;
+  if (DIR *d = opendir(dir.c_str())) {
+    while (const dirent *entry = readdir(d)) {
+      const std::string name = entry->d_name;
+      if (name.size() > 4 && (name.compare(name.size() - 4, 4, ".pgm") == 0 ||
+                              name.compare(name.size() - 4, 4, ".ppm") == 0)) {
+        names.push_back(name);
+      }
+    }
+    closedir(d);
+  }
+  std::sort(names.begin(), names.end());
+
+  for (const std::string &name : names) {
+    sensor_msgs::Image image_msg;
+    if (!ReadPnm(dir + "/" + name, image_msg)) {
+      std::cout << serial() << ": failed to read " << name << std::endl;
+      continue;
+    }
+    // Replayed frames all have the format of the first one
+    if (!replay_.empty() && (image_msg.encoding != replay_[0].encoding ||
+                             image_msg.width != replay_[0].width ||
+                             image_msg.height != replay_[0].height)) {
+      std::cout << serial() << ": skipped " << name
+                << ", format differs from the first frame" << std::endl;
+      continue;
+    }
+    replay_.push_back(std::move(image_msg));
+  }
+  std::cout << serial() << ": replaying " << replay_.size() << " frames from "
+            << dir << std::endl;
+}
+
+std::vector<int> SimulatedCamera::pixel_clocks() const {
+  // The clocks of a BlueFOX, the simulated frames do not depend on them
+  return {12000, 20000, 24000, 27000, 32000, 40000, 50000};
+}
+
+Bluefox2Stats SimulatedCamera::GetStats() const {
+  Bluefox2Stats stats;
+  stats.frame_count = frame_count_;
+  stats.wait_timeouts = wait_timeouts_;
+  stats.failed_requests = failed_requests_;
+  return stats;
+}
+
+int64_t SimulatedCamera::SetExpose(int &expose_us, double &gain_db,
+                                   bool set_gain, int timeout_ms) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  expose_us_ = expose_us;
+  if (set_gain) {
+    gain_db_ = gain_db;
+  } else {
+    gain_db = gain_db_;
+  }
+  // Requests take the values when they are queued, so the next request is
+  // the first one to show them
+  return next_frame_nr_;
+}
+
+void SimulatedCamera::RequestSingle() const {
+  const auto start = Clock::now();
+  bool queued = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queued = QueueRequest();
+  }
+  latency_.Record(LatencyStage::kRequest, start);
+  if (!queued) {
+    ++failed_requests_;
+    std::cout << serial() << ": Error while requesting image: no free request"
+              << std::endl;
+  }
+}
+
+bool SimulatedCamera::QueueRequest() const {
+  if (static_cast<int>(queue_.size()) >= request_count_) return false;
+
+  const auto now = Clock::now();
+  const auto expose = std::chrono::microseconds(expose_us_);
+  Clock::time_point start;
+  if (config_.ctm == Bluefox2Dyn_ctm_on_demand ||
+      config_.ctm == Bluefox2Dyn_hard_sync) {
+    // Exposes right away once the sensor is done with the last exposure
+    start = std::max(now, last_expose_start_ + expose);
+  } else {
+    // The sensor is triggered at fps, each request takes the next slot
+    const auto period = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(1 / std::max(config_.fps, 1.0)));
+    const auto earliest =
+        std::max(now, last_expose_start_ + Clock::duration(1)) - origin_;
+    start = origin_ + ((earliest + period - Clock::duration(1)) / period) *
+                          period;
+  }
+  last_expose_start_ = start;
+  queue_.push_back(Request{next_frame_nr_++, start,
+                           start + expose + transfer_delay_, expose_us_,
+                           gain_db_});
+  cond_.notify_all();
+  return true;
+}
+
+void SimulatedCamera::Configure(Bluefox2DynConfig &config) {
+  // Sensor of the mvBlueFOX-MLC200w
+  static const int kSensorWidth = 752;
+  static const int kSensorHeight = 480;
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (!replay_.empty()) {
+    // The recording decides the format
+    config.width = replay_[0].width;
+    config.height = replay_[0].height;
+    encoding_ = replay_[0].encoding;
+  } else {
+    if (config.width <= 0) config.width = kSensorWidth;
+    if (config.height <= 0) config.height = kSensorHeight;
+    config.width = std::min(config.width, kSensorWidth);
+    config.height = std::min(config.height, kSensorHeight);
+    switch (config.idpf) {
+      case Bluefox2Dyn_idpf_mono16:
+        encoding_ = enc::MONO16;
+        break;
+      case Bluefox2Dyn_idpf_rgb888_packed:
+        encoding_ = enc::RGB8;
+        break;
+      case Bluefox2Dyn_idpf_bgr888_packed:
+        encoding_ = enc::BGR8;
+        break;
+      default:
+        encoding_ = enc::MONO8;
+    }
+  }
+  config.offset_x = std::min(config.offset_x, kSensorWidth - config.width);
+  config.offset_y = std::min(config.offset_y, kSensorHeight - config.height);
+
+  // Auto control, white balance and the filters of the driver are not
+  // simulated, report them as off
+  config.aec = false;
+  config.agc = false;
+  config.acs = Bluefox2Dyn_acs_unavailable;
+  config.wbp = Bluefox2Dyn_wbp_unavailable;
+  config.hdr = false;
+  config.bracket_count = 1;
+  config.dcfm = Bluefox2Dyn_dcfm_off;
+  config.cts = Bluefox2Dyn_cts_unavailable;
+  expose_us_ = config.expose_us;
+  gain_db_ = config.gain_db;
+  config_ = config;
+
+  // Queued requests belong to the old settings
+  queue_.clear();
+  last_expose_start_ = Clock::time_point();
+  config.request = std::min(config.request, request_count_ - 1);
+  for (int i = 0; i < config.request; ++i) {
+    QueueRequest();
+  }
+  config_.request = config.request;
+}
+
+bool SimulatedCamera::GrabImage(sensor_msgs::Image &image_msg,
+                                FrameMetadata *metadata) {
+  auto time = Clock::now();
+  const auto deadline = time + std::chrono::milliseconds(timeout_ms_);
+  Request request;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    // Wait for a request to be queued and then for its frame to arrive
+    while (queue_.empty() || Clock::now() < queue_.front().ready) {
+      if (Clock::now() >= deadline) {
+        ++wait_timeouts_;
+        return false;
+      }
+      cond_.wait_until(lock, queue_.empty()
+                                 ? deadline
+                                 : std::min(deadline, queue_.front().ready));
+    }
+    request = queue_.front();
+    queue_.pop_front();
+    if (streaming_) QueueRequest();
+  }
+
+  const auto arrival = ros::Time::now();
+  time = latency_.Record(LatencyStage::kWait, time);
+  Render(request, image_msg);
+  ++frame_count_;
+
+  FrameMetadata frame;
+  frame.frame_nr = request.frame_nr;
+  frame.expose_start_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                              request.expose_start - origin_).count();
+  frame.expose_us = request.expose_us;
+  frame.gain_db = request.gain_db;
+  frame.transfer_delay_us =
+      std::chrono::duration_cast<std::chrono::microseconds>(transfer_delay_)
+          .count();
+  if (metadata) *metadata = frame;
+
+  if (hw_stamp_) {
+    // The simulation runs on the host clock, so the middle of the exposure
+    // is known exactly
+    const auto middle =
+        request.expose_start + std::chrono::microseconds(request.expose_us / 2);
+    const auto age = std::chrono::duration<double>(Clock::now() - middle);
+    image_msg.header.stamp = arrival - ros::Duration(age.count());
+  }
+  latency_.Record(LatencyStage::kCopy, time);
+  return true;
+}
+
+void SimulatedCamera::Render(const Request &request,
+                             sensor_msgs::Image &image_msg) const {
+  if (!replay_.empty()) {
+    const auto &frame = replay_[request.frame_nr % replay_.size()];
+    image_msg.encoding = frame.encoding;
+    image_msg.width = frame.width;
+    image_msg.height = frame.height;
+    image_msg.step = frame.step;
+    image_msg.is_bigendian = frame.is_bigendian;
+    image_msg.data = frame.data;
+    return;
+  }
+
+  // Exposure at which the test pattern fills the 8 bit range
+  static const double kFullScaleExposeUs = 10000;
+  const double scale = request.expose_us / kFullScaleExposeUs *
+                       std::pow(10.0, request.gain_db / 20);
+  std::array<uint8_t, 256> lut;
+  for (int i = 0; i < 256; ++i) {
+    lut[i] = static_cast<uint8_t>(std::min(i * scale, 255.0));
+  }
+
+  const int channels = enc::numChannels(encoding_);
+  const int bytes = enc::bitDepth(encoding_) / 8;
+  image_msg.encoding = encoding_;
+  image_msg.width = config_.width;
+  image_msg.height = config_.height;
+  image_msg.step = image_msg.width * channels * bytes;
+  image_msg.is_bigendian = 0;
+  image_msg.data.resize(image_msg.step * image_msg.height);
+
+  // Diagonal ramps that move by one pixel per frame
+  for (uint32_t y = 0; y < image_msg.height; ++y) {
+    uint8_t *row = &image_msg.data[y * image_msg.step];
+    for (uint32_t x = 0; x < image_msg.width; ++x) {
+      const uint8_t value = lut[(x + y + request.frame_nr) & 0xff];
+      for (int c = 0; c < channels; ++c) {
+        // 16 bit samples are little endian with the value in the high byte
+        uint8_t *sample = row + (x * channels + c) * bytes;
+        sample[bytes - 1] = value;
+        if (bytes == 2) sample[0] = 0;
+      }
+    }
+  }
+}
+
+void SimulatedCamera::StartStreaming() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  while (QueueRequest()) {
+  }
+  streaming_ = true;
+}
+
+void SimulatedCamera::CancelRequests() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  queue_.clear();
+}
+
+void SimulatedCamera::SetRequestCount(int &request_count) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  request_count_ = std::max(request_count, 1);
+  request_count = request_count_;
+}
+
+}  // namespace bluefox2
@@ -1,36 +1,118 @@
 #include "bluefox2/single_node.h"
 #include "bluefox2/bluefox2_ros.h"
 
+#include <chrono>
+#include <thread>
+
 namespace bluefox2 {
 
+// Frames waiting to be published before the oldest one is dropped
+static const size_t kMaxQueuedFrames = 2;
+// How often a paused stream checks for subscribers
+static const auto kIdlePoll = std::chrono::milliseconds(10);
+
 SingleNode::SingleNode(const ros::NodeHandle& pnh)
     : CameraNodeBase(pnh),
-      bluefox2_ros_(boost::make_shared<Bluefox2Ros>(pnh)) {}
+      bluefox2_ros_(boost::make_shared<Bluefox2Ros>(pnh)) {
+  pnh.param<bool>("stream", stream_, false);
+  pnh.param<bool>("align_triggers", align_triggers_, false);
+}
 
 void SingleNode::Acquire() {
+  // A hardware timed camera only captures for requests that are queued
+  if (stream_ || bluefox2_ros_->camera().hardware_timed()) {
+    AcquireStream();
+    return;
+  }
+
+  // Trigger on a fixed grid, so that grabbing and publishing do not stretch
+  // the period
+  FrameScheduler scheduler(bluefox2_ros_->fps(), align_triggers_);
+  bluefox2_ros_->set_scheduler(&scheduler);
   while (is_acquire() && ros::ok()) {
+    if (!bluefox2_ros_->HasSubscribers()) {
+      scheduler.Pause();
+      continue;
+    }
+    scheduler.Wait();
     bluefox2_ros_->RequestSingle();
-    const auto expose_us = bluefox2_ros_->camera().GetExposeUs();
-    const auto expose_duration = ros::Duration(expose_us * 1e-6 / 2);
-    const auto time = ros::Time::now() + expose_duration;
-    bluefox2_ros_->PublishCamera(time);
-    Sleep();
+    const auto time = ros::Time::now();
+    bluefox2_ros_->GrabAndPublish(time);
+  }
+  bluefox2_ros_->set_scheduler(nullptr);
+}
+
+void SingleNode::AcquireStream() {
+  auto& camera = bluefox2_ros_->camera();
+
+  publishing_ = true;
+  std::thread publish_thread(&SingleNode::PublishStream, this);
+
+  while (is_acquire() && ros::ok()) {
+    // Nothing is transferred while paused, the camera stays set up so the
+    // stream restarts within a frame
+    const bool active = bluefox2_ros_->HasSubscribers();
+    bluefox2_ros_->SetStreaming(active);
+    if (!active) {
+      std::this_thread::sleep_for(kIdlePoll);
+      continue;
+    }
+
+    const auto image_msg = bluefox2_ros_->AllocateImage();
+    FrameMetadata metadata;
+    if (!camera.GrabImage(*image_msg, &metadata)) continue;
+    if (!camera.hw_stamp()) {
+      // The frame has just arrived, so the middle of the exposure is behind us
+      const auto expose_duration = ros::Duration(metadata.expose_us * 1e-6 / 2);
+      image_msg->header.stamp = ros::Time::now() - expose_duration;
+    }
+    bluefox2_ros_->PublishMetadata(metadata, image_msg->header.stamp);
+    bluefox2_ros_->ProcessGrabbed(*image_msg, metadata);
+
+    std::lock_guard<std::mutex> lock(frames_mutex_);
+    if (frames_.size() >= kMaxQueuedFrames) {
+      frames_.pop_front();
+    }
+    frames_.push_back(image_msg);
+    frames_cond_.notify_one();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(frames_mutex_);
+    publishing_ = false;
+    frames_cond_.notify_one();
+  }
+  publish_thread.join();
+  bluefox2_ros_->SetStreaming(false);
+}
+
+void SingleNode::PublishStream() {
+  while (true) {
+    sensor_msgs::ImagePtr image_msg;
+    {
+      std::unique_lock<std::mutex> lock(frames_mutex_);
+      frames_cond_.wait(lock,
+                        [this] { return !publishing_ || !frames_.empty(); });
+      if (frames_.empty()) break;
+      image_msg = frames_.front();
+      frames_.pop_front();
+    }
+    bluefox2_ros_->PublishImage(image_msg);
   }
 }
 
 void SingleNode::AcquireOnce() {
   if (is_acquire() && ros::ok()) {
     bluefox2_ros_->RequestSingle();
-    const auto expose_us = bluefox2_ros_->camera().GetExposeUs();
-    const auto expose_duration = ros::Duration(expose_us * 1e-6 / 2);
-    const auto time = ros::Time::now() + expose_duration;
-    bluefox2_ros_->PublishCamera(time);
+    const auto time = ros::Time::now();
+    bluefox2_ros_->GrabAndPublish(time);
   }
 }
 
 void SingleNode::Setup(Bluefox2DynConfig& config) {
-  bluefox2_ros_->set_fps(config.fps);
+  // The camera lowers fps to what the sensor can reach
   bluefox2_ros_->camera().Configure(config);
+  bluefox2_ros_->set_fps(config.fps);
 }
 
 }  // namepace bluefox2
@@ -3,43 +3,181 @@
 
 namespace bluefox2 {
 
-StereoNode::StereoNode(const ros::NodeHandle &pnh)
-    : CameraNodeBase(pnh),
-      left_ros_(boost::make_shared<Bluefox2Ros>(pnh, "left")),
-      right_ros_(boost::make_shared<Bluefox2Ros>(pnh, "right")) {}
+// Images of one camera that wait for their partner before being dropped
+static const size_t kPairRingSize = 4;
+
+StereoNode::StereoNode(const ros::NodeHandle &pnh) : CameraNodeBase(pnh) {
+  OpenDevices(pnh, {"left", "right"});
+  left_ros_ = boost::make_shared<Bluefox2Ros>(pnh, "left");
+  right_ros_ = boost::make_shared<Bluefox2Ros>(pnh, "right");
+
+  // Left camera triggers the right one through its flash output
+  pnh.param<bool>("sync", sync_, false);
+  pnh.param<double>("sync_tolerance_ms", sync_tolerance_ms_, 0);
+  pnh.param<bool>("align_triggers", align_triggers_, false);
+  if (sync_) {
+    left_ros_->camera().SetMaster();
+    right_ros_->camera().SetSlave();
+  }
+}
 
 void StereoNode::Acquire() {
+  // A hardware timed master is paired with its slave like a host triggered one
+  if (sync_) {
+    AcquirePaired();
+    return;
+  }
+
+  FrameScheduler scheduler(left_ros_->fps(), align_triggers_);
+  left_ros_->set_scheduler(&scheduler);
   while (is_acquire() && ros::ok()) {
+    if (!HasSubscribers()) {
+      scheduler.Pause();
+      continue;
+    }
+    scheduler.Wait();
     left_ros_->RequestSingle();
     right_ros_->RequestSingle();
-    const auto expose_us = left_ros_->camera().GetExposeUs();
-    const auto expose_duration = ros::Duration(expose_us * 1e-6 / 2);
-    const auto time = ros::Time::now() + expose_duration;
-    left_ros_->PublishCamera(time);
-    right_ros_->PublishCamera(time);
-    Sleep();
+    const auto time = ros::Time::now();
+    left_ros_->GrabAndPublish(time);
+    right_ros_->GrabAndPublish(time);
   }
+  left_ros_->set_scheduler(nullptr);
+}
+
+bool StereoNode::HasSubscribers() const {
+  // Both cameras are captured together, so either one keeps them running
+  return left_ros_->HasSubscribers() || right_ros_->HasSubscribers();
 }
 
 void StereoNode::AcquireOnce() {
   if (is_acquire() && ros::ok()) {
     left_ros_->RequestSingle();
     right_ros_->RequestSingle();
-    const auto expose_us = left_ros_->camera().GetExposeUs();
+    const auto time = ros::Time::now();
+    left_ros_->GrabAndPublish(time);
+    right_ros_->GrabAndPublish(time);
+  }
+}
+
+/**
+ * @brief GrabStamped Grab an image and stamp it with the middle of its
+ * exposure, from the camera clock if hardware stamping is enabled and from
+ * the arrival time otherwise, then process it like every grabbed image
+ */
+static bool GrabStamped(Bluefox2Ros &bf2_ros, StereoFrame &frame) {
+  auto &camera = bf2_ros.camera();
+  frame.image = bf2_ros.AllocateImage();
+  if (!camera.GrabImage(*frame.image, &frame.metadata)) return false;
+  if (!camera.hw_stamp()) {
+    const auto expose_us = frame.metadata.expose_us;
     const auto expose_duration = ros::Duration(expose_us * 1e-6 / 2);
-    const auto time = ros::Time::now() + expose_duration;
-    left_ros_->PublishCamera(time);
-    right_ros_->PublishCamera(time);
+    frame.image->header.stamp = ros::Time::now() - expose_duration;
   }
+  bf2_ros.ProcessGrabbed(*frame.image, frame.metadata);
+  return true;
+}
+
+void StereoNode::AcquirePaired() {
+  // The master is triggered by its real time controller or from the host, the
+  // slave follows it
+  const bool timed = left_ros_->camera().hardware_timed();
+  // Keep requests queued on the slave, so that it is armed for every trigger
+  right_ros_->SetStreaming(true);
+
+  StereoPairer pairer(kPairRingSize);
+  if (sync_tolerance_ms_ > 0) {
+    pairer.set_tolerance(ros::Duration(sync_tolerance_ms_ * 1e-3));
+  } else {
+    // Half a frame apart can only be neighbouring frames
+    pairer.set_tolerance(ros::Duration(0.5 / left_ros_->fps()));
+  }
+
+  // Master triggers follow the grid, the slave follows the master
+  FrameScheduler scheduler(left_ros_->fps(), align_triggers_);
+  if (!timed) left_ros_->set_scheduler(&scheduler);
+
+  size_t dropped = 0;
+  while (is_acquire() && ros::ok()) {
+    // Without master triggers the armed slave stays idle as well, the stream
+    // of a timed master has to be stopped
+    const bool active = HasSubscribers();
+    if (timed) left_ros_->SetStreaming(active);
+    if (!active) {
+      scheduler.Pause();
+      continue;
+    }
+    if (!timed) {
+      scheduler.Wait();
+      left_ros_->RequestSingle();
+    }
+
+    StereoPair pair;
+    StereoFrame left;
+    if (GrabStamped(*left_ros_, left) && pairer.AddLeft(left, pair)) {
+      PublishPair(pair);
+    }
+    // A late right image stays in the ring and is matched on a later round
+    StereoFrame right;
+    if (GrabStamped(*right_ros_, right) && pairer.AddRight(right, pair)) {
+      PublishPair(pair);
+    }
+
+    if (pairer.dropped() > dropped) {
+      ROS_WARN_THROTTLE(1, "%s: Dropped %zu unmatched stereo images",
+                        pnh().getNamespace().c_str(),
+                        pairer.dropped() - dropped);
+      dropped = pairer.dropped();
+    }
+  }
+  left_ros_->set_scheduler(nullptr);
+
+  left_ros_->SetStreaming(false);
+  right_ros_->SetStreaming(false);
+}
+
+void StereoNode::PublishPair(const StereoPair &pair) {
+  const auto &stamp = pair.left.image->header.stamp;
+  left_ros_->PublishMetadata(pair.left.metadata, stamp);
+  right_ros_->PublishMetadata(pair.right.metadata, stamp);
+  left_ros_->PublishImage(pair.left.image);
+  right_ros_->PublishImage(pair.right.image);
 }
 
 void StereoNode::Setup(Bluefox2DynConfig &config) {
+  // Independent real time controllers drift apart, so only a master may be
+  // hardware timed
+  const bool timed = config.ctm == Bluefox2Dyn_ctm_hardware_timed;
+  if (timed && !sync_) {
+    ROS_WARN("%s: hardware_timed needs sync, using on_demand instead",
+             pnh().getNamespace().c_str());
+    config.ctm = Bluefox2Dyn_ctm_on_demand;
+  }
+  // Keep the master and slave trigger modes, a timed master still triggers
+  // the slave through its flash output
+  auto left_config = config;
+  if (sync_) {
+    config.ctm = Bluefox2Dyn_hard_sync;
+    if (timed) {
+      // The flash output is the first digital output
+      left_config.rtc_digout &= ~1;
+    } else {
+      left_config.ctm = Bluefox2Dyn_hard_sync;
+    }
+  }
+  const bool was_timed = left_ros_->camera().hardware_timed();
+  left_ros_->camera().Configure(left_config);
+  right_ros_->camera().Configure(config);
+  // Hard sync leaves the trigger mode alone, which the controller took over
+  if (sync_ && was_timed && !left_ros_->camera().hardware_timed()) {
+    left_ros_->camera().SetMaster();
+  }
+  if (sync_ && left_ros_->camera().hardware_timed()) {
+    config.ctm = Bluefox2Dyn_ctm_hardware_timed;
+  }
+  // The camera lowers fps to what the sensor can reach
   left_ros_->set_fps(config.fps);
   right_ros_->set_fps(config.fps);
-  // Some hacky stuff... work on it later
-  auto config_cpy = config;
-  left_ros_->camera().Configure(config_cpy);
-  right_ros_->camera().Configure(config);
 }
 
 }  // namepace bluefox2
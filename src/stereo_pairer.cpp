@@ -0,0 +1,59 @@
+#include "bluefox2/stereo_pairer.h"
+
+namespace bluefox2 {
+
+bool StereoPairer::AddLeft(const StereoFrame &frame, StereoPair &pair) {
+  if (!Add(frame, left_, right_, pair.right)) return false;
+  pair.left = frame;
+  // The master exposure starts both images
+  pair.right.image->header.stamp = pair.left.image->header.stamp;
+  return true;
+}
+
+bool StereoPairer::AddRight(const StereoFrame &frame, StereoPair &pair) {
+  if (!Add(frame, right_, left_, pair.left)) return false;
+  pair.right = frame;
+  pair.right.image->header.stamp = pair.left.image->header.stamp;
+  return true;
+}
+
+void StereoPairer::Reset() {
+  left_.clear();
+  right_.clear();
+}
+
+bool StereoPairer::Add(const StereoFrame &frame, std::deque<StereoFrame> &own,
+                       std::deque<StereoFrame> &other, StereoFrame &partner) {
+  const auto &stamp = frame.image->header.stamp;
+
+  // Closest waiting image of the other camera
+  auto best = other.end();
+  ros::Duration best_diff = tolerance_;
+  for (auto it = other.begin(); it != other.end(); ++it) {
+    auto diff = it->image->header.stamp - stamp;
+    if (diff < ros::Duration(0)) diff = -diff;
+    if (diff <= best_diff) {
+      best_diff = diff;
+      best = it;
+    }
+  }
+
+  if (best == other.end()) {
+    own.push_back(frame);
+    if (own.size() > capacity_) {
+      own.pop_front();
+      ++dropped_;
+    }
+    return false;
+  }
+
+  // Everything that arrived before the match has missed its partner
+  const auto skipped = static_cast<size_t>(best - other.begin());
+  dropped_ += skipped + own.size();
+  partner = *best;
+  other.erase(other.begin(), best + 1);
+  own.clear();
+  return true;
+}
+
+}  // namespace bluefox2
@@ -0,0 +1,145 @@
+#include "bluefox2/usb_bandwidth.h"
+#include "bluefox2/bluefox2_setting.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace bluefox2 {
+
+UsbDemand MakeUsbDemand(const Bluefox2DynConfig &config,
+                        const std::vector<int> &pclks_khz) {
+  UsbDemand demand;
+  demand.width = config.width;
+  demand.height = config.height;
+  // Color conversion happens on the host, only 16 bit output takes two bytes
+  // on the bus
+  demand.bytes_per_pixel = config.idpf == Bluefox2Dyn_idpf_mono16 ? 2 : 1;
+  demand.pclk_khz = config.cpc;
+  demand.fps = config.fps;
+  demand.expose_us = config.aec && config.ac_expose_max_us > 0
+                         ? config.ac_expose_max_us
+                         : config.expose_us;
+  demand.pclks_khz = pclks_khz;
+  return demand;
+}
+
+double TransferTimeUs(const UsbDemand &demand) {
+  // Readout of the sensor including blanking, as in PixelClockToFrameRate
+  return (demand.width + 61.0) * (demand.height + 45.0) / demand.pclk_khz *
+         1e3;
+}
+
+double PeakRateMBps(const UsbDemand &demand) {
+  return demand.pclk_khz * 1e-3 * demand.bytes_per_pixel;
+}
+
+double MeanRateMBps(const UsbDemand &demand) {
+  return 1e-6 * demand.width * demand.height * demand.bytes_per_pixel *
+         demand.fps;
+}
+
+/**
+ * @brief PlanConcurrent All cameras triggered at once
+ */
+static UsbPlan PlanConcurrent(const std::vector<UsbDemand> &demands) {
+  UsbPlan plan;
+  for (const UsbDemand &demand : demands) {
+    UsbSlot slot;
+    slot.pclk_khz = demand.pclk_khz;
+    slot.transfer_us = TransferTimeUs(demand);
+    slot.peak_mbps = PeakRateMBps(demand);
+    slot.mean_mbps = MeanRateMBps(demand);
+    plan.peak_mbps += slot.peak_mbps;
+    plan.mean_mbps += slot.mean_mbps;
+    plan.slots.push_back(slot);
+  }
+  return plan;
+}
+
+/**
+ * @brief PlanStaggered Transfers one after another within a frame period
+ * @return Plan that is not within budget if the transfers do not fit
+ */
+static UsbPlan PlanStaggered(const std::vector<UsbDemand> &demands,
+                             double budget_mbps) {
+  UsbPlan plan = PlanConcurrent(demands);
+  plan.staggered = true;
+  plan.within_budget = false;
+  if (demands.empty()) return plan;
+
+  // Offsets only hold their phase when all cameras share a period
+  const double fps = demands.front().fps;
+  for (const UsbDemand &demand : demands) {
+    if (demand.fps <= 0 || std::abs(demand.fps - fps) > 1e-6) return plan;
+  }
+
+  // Each transfer starts where the previous one ends, triggers come early by
+  // the exposure of their camera
+  double transfer_start_us = 0;
+  double min_offset_us = 0;
+  plan.peak_mbps = 0;
+  for (size_t i = 0; i < demands.size(); ++i) {
+    UsbSlot &slot = plan.slots[i];
+    slot.offset_us = transfer_start_us - demands[i].expose_us;
+    min_offset_us = std::min(min_offset_us, slot.offset_us);
+    transfer_start_us += slot.transfer_us;
+    plan.peak_mbps = std::max(plan.peak_mbps, slot.peak_mbps);
+  }
+  // The grid repeats every period, so offsets wrap around
+  for (UsbSlot &slot : plan.slots) {
+    slot.offset_us = std::fmod(slot.offset_us - min_offset_us, 1e6 / fps);
+  }
+  plan.within_budget =
+      transfer_start_us <= 1e6 / fps && plan.peak_mbps <= budget_mbps;
+  return plan;
+}
+
+/**
+ * @brief LowerPixelClock Next lower pixel clock that still reaches fps
+ * @return 0 if there is none
+ */
+static int LowerPixelClock(const UsbDemand &demand) {
+  int lower_khz = 0;
+  for (const int pclk_khz : demand.pclks_khz) {
+    if (pclk_khz >= demand.pclk_khz || pclk_khz <= lower_khz) continue;
+    if (PixelClockToFrameRate(pclk_khz, demand.width, demand.height,
+                              demand.expose_us) >= demand.fps) {
+      lower_khz = pclk_khz;
+    }
+  }
+  return lower_khz;
+}
+
+UsbPlan PlanUsbBandwidth(const std::vector<UsbDemand> &demands,
+                         double budget_mbps, bool stagger) {
+  UsbPlan plan = PlanConcurrent(demands);
+  if (plan.peak_mbps <= budget_mbps) return plan;
+
+  if (stagger) {
+    const UsbPlan staggered = PlanStaggered(demands, budget_mbps);
+    if (staggered.within_budget) return staggered;
+  }
+
+  // Slow down the camera that takes the most until the bus keeps up
+  auto planned = demands;
+  while (plan.peak_mbps > budget_mbps) {
+    int index = -1;
+    int lower_khz = 0;
+    for (size_t i = 0; i < planned.size(); ++i) {
+      const int pclk_khz = LowerPixelClock(planned[i]);
+      if (pclk_khz == 0) continue;
+      if (index < 0 ||
+          PeakRateMBps(planned[i]) > PeakRateMBps(planned[index])) {
+        index = static_cast<int>(i);
+        lower_khz = pclk_khz;
+      }
+    }
+    if (index < 0) break;
+    planned[index].pclk_khz = lower_khz;
+    plan = PlanConcurrent(planned);
+  }
+  plan.within_budget = plan.peak_mbps <= budget_mbps;
+  return plan;
+}
+
+}  // namespace bluefox2
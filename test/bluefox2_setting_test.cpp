@@ -0,0 +1,48 @@
+#include "bluefox2/bluefox2_setting.h"
+#include <gtest/gtest.h>
+
+namespace bluefox2 {
+
+/**
+ * @brief The FakeProperty struct Step width and range of a property
+ */
+struct FakeProperty {
+  bool hasStepWidth() const { return step > 0; }
+  int getStepWidth() const { return step; }
+  bool hasMinValue() const { return has_min; }
+  int getMinValue() const { return min; }
+
+  int step;
+  bool has_min;
+  int min;
+};
+
+TEST(RoundToStepWidthTest, RoundsDownToStep) {
+  EXPECT_EQ(32, RoundToStepWidth(FakeProperty{4, false, 0}, 35));
+  EXPECT_EQ(36, RoundToStepWidth(FakeProperty{4, false, 0}, 36));
+}
+
+TEST(RoundToStepWidthTest, StepsStartAtMin) {
+  EXPECT_EQ(34, RoundToStepWidth(FakeProperty{4, true, 2}, 37));
+  EXPECT_EQ(2, RoundToStepWidth(FakeProperty{4, true, 2}, 2));
+}
+
+TEST(RoundToStepWidthTest, KeepsValueWithoutStep) {
+  EXPECT_EQ(37, RoundToStepWidth(FakeProperty{0, false, 0}, 37));
+  EXPECT_EQ(37, RoundToStepWidth(FakeProperty{1, true, 2}, 37));
+}
+
+TEST(PlanPixelClockTest, LowestClockThatReachesFps) {
+  const std::vector<int> pclks_khz = {40000, 6000, 20000, 27000};
+  const int pclk_khz = PlanPixelClock(pclks_khz, 20, 752, 480, 1000);
+  EXPECT_EQ(20000, pclk_khz);
+  EXPECT_GE(PixelClockToFrameRate(pclk_khz, 752, 480, 1000), 20);
+  EXPECT_LT(PixelClockToFrameRate(6000, 752, 480, 1000), 20);
+}
+
+TEST(PlanPixelClockTest, HighestClockIfNoneReachesFps) {
+  const std::vector<int> pclks_khz = {6000, 40000, 20000};
+  EXPECT_EQ(40000, PlanPixelClock(pclks_khz, 1000, 752, 480, 1000));
+}
+
+}  // namespace bluefox2
@@ -0,0 +1,64 @@
+#include "bluefox2/clock_sync.h"
+#include <gtest/gtest.h>
+
+#include <cmath>
+
+namespace bluefox2 {
+
+// Camera clock that runs 20 ppm fast, frames arrive with 1 to 5 ms latency
+static const double kSkew = 20e-6;
+static const double kOffsetS = 1000.0;
+static const double kMinLatencyS = 1e-3;
+
+static double HostTime(int64_t device_us) {
+  return kOffsetS + device_us * 1e-6 * (1 + kSkew);
+}
+
+static double Latency(int i) { return kMinLatencyS + (i * 37 % 5) * 1e-3; }
+
+TEST(ClockSyncTest, NoEstimateBeforeUpdate) {
+  ClockSync sync;
+  EXPECT_FALSE(sync.ready());
+  EXPECT_EQ(0, sync.ToHost(123456));
+}
+
+TEST(ClockSyncTest, FitsLowerEdgeOfLatency) {
+  ClockSync sync(100);
+  for (int i = 0; i < 200; ++i) {
+    const int64_t device_us = i * 10000;
+    sync.Update(device_us, HostTime(device_us) + Latency(i));
+  }
+  ASSERT_TRUE(sync.ready());
+  // Only the constant part of the latency is left, also past the window
+  for (const int64_t device_us : {1500000, 1990000, 2100000}) {
+    EXPECT_NEAR(HostTime(device_us) + kMinLatencyS, sync.ToHost(device_us),
+                1e-5);
+  }
+}
+
+TEST(ClockSyncTest, RepeatedStampsKeepFit) {
+  ClockSync sync;
+  for (int i = 0; i < 10; ++i) {
+    const int64_t device_us = i * 10000;
+    sync.Update(device_us, HostTime(device_us) + kMinLatencyS);
+  }
+  const double host_s = sync.ToHost(100000);
+  sync.Update(90000, HostTime(90000) + kMinLatencyS);
+  sync.Update(90000, HostTime(90000) + kMinLatencyS);
+  EXPECT_TRUE(std::isfinite(sync.ToHost(100000)));
+  EXPECT_NEAR(host_s, sync.ToHost(100000), 1e-6);
+}
+
+TEST(ClockSyncTest, ResetsWhenCameraClockJumpsBack) {
+  ClockSync sync;
+  for (int i = 0; i < 10; ++i) {
+    const int64_t device_us = 5000000 + i * 10000;
+    sync.Update(device_us, HostTime(device_us) + kMinLatencyS);
+  }
+  // The camera was reset and counts from 0 again
+  sync.Update(0, 2000.0);
+  EXPECT_NEAR(2000.0, sync.ToHost(0), 1e-9);
+  EXPECT_NEAR(2000.01, sync.ToHost(10000), 1e-9);
+}
+
+}  // namespace bluefox2
@@ -0,0 +1,68 @@
+#include "bluefox2/exposure_fusion.h"
+#include <gtest/gtest.h>
+#include <sensor_msgs/image_encodings.h>
+
+namespace bluefox2 {
+
+static sensor_msgs::Image MakeImage(uint8_t value, double stamp_s,
+                                    const std::string &encoding =
+                                        sensor_msgs::image_encodings::MONO8) {
+  sensor_msgs::Image image_msg;
+  image_msg.header.stamp = ros::Time(stamp_s);
+  image_msg.encoding = encoding;
+  image_msg.width = 4;
+  image_msg.height = 2;
+  image_msg.step = 4;
+  image_msg.data.assign(image_msg.step * image_msg.height, value);
+  return image_msg;
+}
+
+TEST(ExposureFusionTest, FusesCompleteBracket) {
+  ExposureFusion fusion;
+  sensor_msgs::Image fused_msg;
+  EXPECT_FALSE(fusion.Add(MakeImage(20, 1.0), 0, 3, fused_msg));
+  EXPECT_FALSE(fusion.Add(MakeImage(128, 1.05), 1, 3, fused_msg));
+  ASSERT_TRUE(fusion.Add(MakeImage(240, 1.1), 2, 3, fused_msg));
+  EXPECT_EQ(ros::Time(1.05), fused_msg.header.stamp);
+  ASSERT_EQ(8u, fused_msg.data.size());
+  // Dominated by the well exposed middle frame
+  for (const uint8_t value : fused_msg.data) {
+    EXPECT_NEAR(124, value, 1);
+  }
+}
+
+TEST(ExposureFusionTest, KeepsUniformValues) {
+  ExposureFusion fusion;
+  sensor_msgs::Image fused_msg;
+  fusion.Add(MakeImage(77, 1.0), 0, 2, fused_msg);
+  ASSERT_TRUE(fusion.Add(MakeImage(77, 1.1), 1, 2, fused_msg));
+  for (const uint8_t value : fused_msg.data) {
+    EXPECT_EQ(77, value);
+  }
+  // Clipped samples keep a weight, so they are averaged instead of lost
+  fusion.Add(MakeImage(255, 2.0), 0, 2, fused_msg);
+  ASSERT_TRUE(fusion.Add(MakeImage(255, 2.1), 1, 2, fused_msg));
+  EXPECT_EQ(255, fused_msg.data[0]);
+}
+
+TEST(ExposureFusionTest, LostFrameStartsOver) {
+  ExposureFusion fusion;
+  sensor_msgs::Image fused_msg;
+  EXPECT_FALSE(fusion.Add(MakeImage(20, 1.0), 0, 3, fused_msg));
+  EXPECT_FALSE(fusion.Add(MakeImage(240, 1.1), 2, 3, fused_msg));
+  EXPECT_FALSE(fusion.Add(MakeImage(128, 1.15), 1, 3, fused_msg));
+  // The next bracket is fused again
+  EXPECT_FALSE(fusion.Add(MakeImage(20, 2.0), 0, 3, fused_msg));
+  EXPECT_FALSE(fusion.Add(MakeImage(128, 2.05), 1, 3, fused_msg));
+  EXPECT_TRUE(fusion.Add(MakeImage(240, 2.1), 2, 3, fused_msg));
+}
+
+TEST(ExposureFusionTest, SkipsOtherEncodings) {
+  ExposureFusion fusion;
+  sensor_msgs::Image fused_msg;
+  const auto &mono16 = sensor_msgs::image_encodings::MONO16;
+  EXPECT_FALSE(fusion.Add(MakeImage(20, 1.0, mono16), 0, 2, fused_msg));
+  EXPECT_FALSE(fusion.Add(MakeImage(20, 1.1, mono16), 1, 2, fused_msg));
+}
+
+}  // namespace bluefox2
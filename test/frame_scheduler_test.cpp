@@ -0,0 +1,65 @@
+#include "bluefox2/frame_scheduler.h"
+#include <gtest/gtest.h>
+
+#include <thread>
+
+namespace bluefox2 {
+
+using Clock = FrameScheduler::Clock;
+using std::chrono::milliseconds;
+
+TEST(FrameSchedulerTest, NoRateDoesNotWait) {
+  FrameScheduler scheduler(0, false);
+  const auto start = Clock::now();
+  for (int i = 0; i < 10; ++i) scheduler.Wait();
+  EXPECT_LT(Clock::now() - start, milliseconds(10));
+}
+
+TEST(FrameSchedulerTest, DeadlinesFollowTheGrid) {
+  FrameScheduler scheduler(100, false);
+  auto last = scheduler.Wait();
+  for (int i = 0; i < 5; ++i) {
+    const auto deadline = scheduler.Wait();
+    EXPECT_EQ(milliseconds(10), deadline - last);
+    last = deadline;
+  }
+  EXPECT_EQ(0, scheduler.overruns());
+}
+
+TEST(FrameSchedulerTest, SkipsMissedSlots) {
+  FrameScheduler scheduler(100, false);
+  const auto first = scheduler.Wait();
+  std::this_thread::sleep_for(milliseconds(35));
+  const auto deadline = scheduler.Wait();
+  EXPECT_GE(scheduler.overruns(), 2);
+  // Still in phase with the first deadline
+  EXPECT_EQ(Clock::duration::zero(), (deadline - first) % milliseconds(10));
+  EXPECT_GE(deadline - first, milliseconds(30));
+}
+
+TEST(FrameSchedulerTest, SharedOriginKeepsOffsets) {
+  const auto origin = Clock::now();
+  FrameScheduler first(50, false);
+  FrameScheduler second(50, false, milliseconds(5));
+  first.set_origin(origin);
+  second.set_origin(origin);
+  const auto first_deadline = first.Wait();
+  // Started later, but on the same grid
+  std::this_thread::sleep_for(milliseconds(30));
+  const auto second_deadline = second.Wait();
+  EXPECT_EQ(Clock::duration::zero(),
+            (first_deadline - origin) % milliseconds(20));
+  EXPECT_EQ(milliseconds(5), (second_deadline - origin) % milliseconds(20));
+}
+
+TEST(FrameSchedulerTest, RestartsAfterPause) {
+  FrameScheduler scheduler(100, false);
+  scheduler.Wait();
+  scheduler.Pause();
+  std::this_thread::sleep_for(milliseconds(50));
+  scheduler.Wait();
+  // Slots missed while paused are not overruns
+  EXPECT_EQ(0, scheduler.overruns());
+}
+
+}  // namespace bluefox2
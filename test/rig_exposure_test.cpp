@@ -0,0 +1,54 @@
+#include "bluefox2/rig_exposure.h"
+#include <gtest/gtest.h>
+#include <sensor_msgs/image_encodings.h>
+
+namespace bluefox2 {
+
+static sensor_msgs::Image MakeImage(uint32_t width, uint32_t height,
+                                    uint8_t value) {
+  sensor_msgs::Image image_msg;
+  image_msg.encoding = sensor_msgs::image_encodings::MONO8;
+  image_msg.width = width;
+  image_msg.height = height;
+  // Padding at the end of each row is not measured
+  image_msg.step = width + 4;
+  image_msg.data.assign(image_msg.step * height, value);
+  return image_msg;
+}
+
+TEST(MeasureBrightnessTest, MeanOfUniformImage) {
+  const auto stats = MeasureBrightness(MakeImage(16, 8, 51), 1);
+  EXPECT_EQ(16u * 8u, stats.samples);
+  EXPECT_DOUBLE_EQ(0.2, stats.mean);
+  EXPECT_DOUBLE_EQ(0, stats.clipped);
+}
+
+TEST(MeasureBrightnessTest, SubsamplesRows) {
+  auto image_msg = MakeImage(16, 8, 0);
+  // Only rows 0 and 4 are measured
+  for (uint32_t row = 0; row < image_msg.height; row += 2) {
+    std::fill_n(&image_msg.data[row * image_msg.step], image_msg.width, 255);
+  }
+  const auto stats = MeasureBrightness(image_msg, 4);
+  EXPECT_EQ(16u * 2u, stats.samples);
+  EXPECT_DOUBLE_EQ(1, stats.mean);
+  EXPECT_DOUBLE_EQ(1, stats.clipped);
+
+  const auto all_rows = MeasureBrightness(image_msg, 1);
+  EXPECT_DOUBLE_EQ(0.5, all_rows.mean);
+  EXPECT_DOUBLE_EQ(0.5, all_rows.clipped);
+}
+
+TEST(MeasureBrightnessTest, SkipsOtherEncodings) {
+  auto image_msg = MakeImage(16, 8, 51);
+  image_msg.encoding = sensor_msgs::image_encodings::MONO16;
+  EXPECT_EQ(0u, MeasureBrightness(image_msg).samples);
+}
+
+TEST(MeasureBrightnessTest, SkipsShortData) {
+  auto image_msg = MakeImage(16, 8, 51);
+  image_msg.data.resize(image_msg.data.size() - 1);
+  EXPECT_EQ(0u, MeasureBrightness(image_msg).samples);
+}
+
+}  // namespace bluefox2
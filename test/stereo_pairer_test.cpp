@@ -0,0 +1,64 @@
+#include "bluefox2/stereo_pairer.h"
+#include <gtest/gtest.h>
+
+namespace bluefox2 {
+
+static StereoFrame MakeFrame(double stamp_s) {
+  StereoFrame frame;
+  frame.image = boost::make_shared<sensor_msgs::Image>();
+  frame.image->header.stamp = ros::Time(stamp_s);
+  return frame;
+}
+
+TEST(StereoPairerTest, PairsWithinTolerance) {
+  StereoPairer pairer;
+  pairer.set_tolerance(ros::Duration(0.002));
+  StereoPair pair;
+  EXPECT_FALSE(pairer.AddLeft(MakeFrame(1.0), pair));
+  ASSERT_TRUE(pairer.AddRight(MakeFrame(1.001), pair));
+  // The right image takes the stamp of the master
+  EXPECT_EQ(ros::Time(1.0), pair.left.image->header.stamp);
+  EXPECT_EQ(ros::Time(1.0), pair.right.image->header.stamp);
+  EXPECT_EQ(0u, pairer.dropped());
+}
+
+TEST(StereoPairerTest, RightFirst) {
+  StereoPairer pairer;
+  StereoPair pair;
+  EXPECT_FALSE(pairer.AddRight(MakeFrame(2.0), pair));
+  ASSERT_TRUE(pairer.AddLeft(MakeFrame(2.0), pair));
+  EXPECT_EQ(ros::Time(2.0), pair.right.image->header.stamp);
+}
+
+TEST(StereoPairerTest, DropsImagesWithoutPartner) {
+  StereoPairer pairer;
+  pairer.set_tolerance(ros::Duration(0.002));
+  StereoPair pair;
+  EXPECT_FALSE(pairer.AddLeft(MakeFrame(1.0), pair));
+  EXPECT_FALSE(pairer.AddLeft(MakeFrame(1.05), pair));
+  // Matches the second left image, the first one has missed its partner
+  ASSERT_TRUE(pairer.AddRight(MakeFrame(1.05), pair));
+  EXPECT_EQ(ros::Time(1.05), pair.left.image->header.stamp);
+  EXPECT_EQ(1u, pairer.dropped());
+}
+
+TEST(StereoPairerTest, DoesNotPairOutsideTolerance) {
+  StereoPairer pairer;
+  pairer.set_tolerance(ros::Duration(0.002));
+  StereoPair pair;
+  EXPECT_FALSE(pairer.AddLeft(MakeFrame(1.0), pair));
+  EXPECT_FALSE(pairer.AddRight(MakeFrame(1.01), pair));
+}
+
+TEST(StereoPairerTest, RingDropsOldest) {
+  StereoPairer pairer(2);
+  StereoPair pair;
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_FALSE(pairer.AddLeft(MakeFrame(1.0 + i * 0.05), pair));
+  }
+  EXPECT_EQ(1u, pairer.dropped());
+  // The oldest image is gone, so its partner waits instead
+  EXPECT_FALSE(pairer.AddRight(MakeFrame(1.0), pair));
+}
+
+}  // namespace bluefox2
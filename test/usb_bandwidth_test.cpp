@@ -0,0 +1,86 @@
+#include "bluefox2/usb_bandwidth.h"
+#include "bluefox2/bluefox2_setting.h"
+#include <gtest/gtest.h>
+
+namespace bluefox2 {
+
+// Wide VGA at the highest pixel clock of the mvBlueFOX-MLC
+static UsbDemand MakeDemand(double fps, double expose_us) {
+  UsbDemand demand;
+  demand.width = 752;
+  demand.height = 480;
+  demand.pclk_khz = 40000;
+  demand.fps = fps;
+  demand.expose_us = expose_us;
+  demand.pclks_khz = {6000, 8000, 10000, 13500, 20000, 24000, 27000, 32000,
+                      40000};
+  return demand;
+}
+
+TEST(UsbBandwidthTest, ConcurrentWithinBudget) {
+  const std::vector<UsbDemand> demands(2, MakeDemand(20, 1000));
+  const auto plan = PlanUsbBandwidth(demands, 100, true);
+  EXPECT_FALSE(plan.staggered);
+  EXPECT_TRUE(plan.within_budget);
+  EXPECT_DOUBLE_EQ(80, plan.peak_mbps);
+  for (const UsbSlot &slot : plan.slots) {
+    EXPECT_EQ(40000, slot.pclk_khz);
+    EXPECT_EQ(0, slot.offset_us);
+  }
+}
+
+TEST(UsbBandwidthTest, StaggersTransfers) {
+  const std::vector<UsbDemand> demands(2, MakeDemand(20, 1000));
+  const auto plan = PlanUsbBandwidth(demands, 50, true);
+  ASSERT_TRUE(plan.staggered);
+  EXPECT_TRUE(plan.within_budget);
+  EXPECT_DOUBLE_EQ(40, plan.peak_mbps);
+  ASSERT_EQ(2u, plan.slots.size());
+  // The second transfer starts where the first one ends
+  EXPECT_NEAR(0, plan.slots[0].offset_us, 1e-6);
+  EXPECT_NEAR(TransferTimeUs(demands[0]), plan.slots[1].offset_us, 1e-6);
+  EXPECT_EQ(40000, plan.slots[1].pclk_khz);
+}
+
+TEST(UsbBandwidthTest, StaggeredOffsetsStayInPeriod) {
+  // The long exposure of the first camera pushes the second one past the
+  // end of the period
+  const std::vector<UsbDemand> demands = {MakeDemand(20, 45000),
+                                          MakeDemand(20, 0)};
+  const auto plan = PlanUsbBandwidth(demands, 50, true);
+  ASSERT_TRUE(plan.staggered);
+  for (const UsbSlot &slot : plan.slots) {
+    EXPECT_GE(slot.offset_us, 0);
+    EXPECT_LT(slot.offset_us, 50000);
+  }
+}
+
+TEST(UsbBandwidthTest, DifferentRatesAreNotStaggered) {
+  const std::vector<UsbDemand> demands = {MakeDemand(20, 1000),
+                                          MakeDemand(25, 1000)};
+  const auto plan = PlanUsbBandwidth(demands, 50, true);
+  EXPECT_FALSE(plan.staggered);
+}
+
+TEST(UsbBandwidthTest, LowersPixelClocks) {
+  const std::vector<UsbDemand> demands(2, MakeDemand(20, 1000));
+  const auto plan = PlanUsbBandwidth(demands, 50, false);
+  EXPECT_FALSE(plan.staggered);
+  EXPECT_TRUE(plan.within_budget);
+  EXPECT_LE(plan.peak_mbps, 50);
+  for (const UsbSlot &slot : plan.slots) {
+    EXPECT_GE(PixelClockToFrameRate(slot.pclk_khz, 752, 480, 1000), 20);
+  }
+}
+
+TEST(UsbBandwidthTest, KeepsFpsOverBudget) {
+  // No clock that reaches fps fits, so the plan stays over budget
+  const std::vector<UsbDemand> demands(4, MakeDemand(60, 1000));
+  const auto plan = PlanUsbBandwidth(demands, 50, false);
+  EXPECT_FALSE(plan.within_budget);
+  for (const UsbSlot &slot : plan.slots) {
+    EXPECT_GE(PixelClockToFrameRate(slot.pclk_khz, 752, 480, 1000), 60);
+  }
+}
+
+}  // namespace bluefox2